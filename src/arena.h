@@ -0,0 +1,197 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <new>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+/**
+ * recycled memory for large buffers of positions. Allocations of at least HUGE_PAGE_SIZE bytes are
+ * mapped directly, aligned to and rounded up to whole huge pages and advised to be backed by
+ * transparent huge pages, which cuts the amount of page faults and tlb misses when gigabytes of
+ * positions are touched. Released regions are kept by the pool and handed out again for the next
+ * allocation which fits, so buffers of similar size, like the buckets of a shuffle, only fault their
+ * pages in once. Smaller allocations go through the regular allocator.
+ */
+#define HUGE_PAGE_SIZE (2ULL << 20)
+
+/**
+ * maps the given amount of bytes, a multiple of HUGE_PAGE_SIZE, at an address aligned to
+ * HUGE_PAGE_SIZE.
+ * @return nullptr if the memory could not be mapped
+ */
+inline void* map_huge_pages(size_t bytes) {
+  // map one more huge page and unmap the unaligned head and tail
+  const size_t mapped = bytes + HUGE_PAGE_SIZE;
+  void* p             = mmap(nullptr, mapped, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (p == MAP_FAILED)
+    return nullptr;
+
+  const uintptr_t start   = (uintptr_t) p;
+  const uintptr_t aligned = (start + HUGE_PAGE_SIZE - 1) & ~(uintptr_t) (HUGE_PAGE_SIZE - 1);
+  if (aligned > start)
+    munmap(p, aligned - start);
+  if (start + mapped > aligned + bytes)
+    munmap((void*) (aligned + bytes), start + mapped - aligned - bytes);
+
+#ifdef MADV_HUGEPAGE
+  madvise((void*) aligned, bytes, MADV_HUGEPAGE);
+#endif
+  return (void*) aligned;
+}
+
+struct BufferPool {
+  std::mutex mutex {};
+  // regions handed out, by address, and released regions kept for reuse
+  std::unordered_map<void*, size_t> used {};
+  std::vector<std::pair<void*, size_t>> cached {};
+  size_t cached_bytes = 0;
+  size_t limit;
+
+  /**
+   * keeps up to a quarter of the physical memory in released regions by default.
+   */
+  BufferPool() {
+    const long pages = sysconf(_SC_PHYS_PAGES);
+    const long size  = sysconf(_SC_PAGESIZE);
+    limit            = pages > 0 && size > 0 ? (size_t) pages * size / 4 : 0;
+  }
+
+  BufferPool(const BufferPool&)            = delete;
+  BufferPool& operator=(const BufferPool&) = delete;
+
+  ~BufferPool() {
+    trim();
+  }
+
+  /**
+   * @return uninitialised memory for the given amount of bytes, nullptr if it could not be allocated
+   */
+  void* allocate(size_t bytes) {
+    if (bytes < HUGE_PAGE_SIZE)
+      return ::operator new(bytes, std::nothrow);
+    bytes = (bytes + HUGE_PAGE_SIZE - 1) & ~(HUGE_PAGE_SIZE - 1);
+
+    std::lock_guard<std::mutex> lock {mutex};
+
+    // the smallest released region which fits, as long as it is not much larger than needed
+    size_t best = cached.size();
+    for (size_t i = 0; i < cached.size(); i++)
+      if (cached[i].second >= bytes && cached[i].second <= 2 * bytes
+          && (best == cached.size() || cached[i].second < cached[best].second))
+        best = i;
+
+    void* p = nullptr;
+    if (best < cached.size()) {
+      p     = cached[best].first;
+      bytes = cached[best].second;
+      cached_bytes -= bytes;
+      cached[best] = cached.back();
+      cached.pop_back();
+    } else {
+      p = map_huge_pages(bytes);
+      if (p == nullptr)
+        return nullptr;
+    }
+    used[p] = bytes;
+    return p;
+  }
+
+  /**
+   * returns memory from allocate to the pool. Regions beyond the limit of the pool are unmapped.
+   */
+  void release(void* p, size_t bytes) {
+    if (p == nullptr)
+      return;
+    if (bytes < HUGE_PAGE_SIZE) {
+      ::operator delete(p);
+      return;
+    }
+
+    std::lock_guard<std::mutex> lock {mutex};
+    auto it = used.find(p);
+    bytes   = it->second;
+    used.erase(it);
+    if (cached_bytes + bytes > limit) {
+      munmap(p, bytes);
+      return;
+    }
+    cached.emplace_back(p, bytes);
+    cached_bytes += bytes;
+  }
+
+  /**
+   * unmaps all released regions.
+   */
+  void trim() {
+    std::lock_guard<std::mutex> lock {mutex};
+    for (auto& [p, bytes] : cached)
+      munmap(p, bytes);
+    cached.clear();
+    cached_bytes = 0;
+  }
+};
+
+/**
+ * returns the pool shared by all buffers.
+ */
+inline BufferPool& buffer_pool() {
+  static BufferPool pool {};
+  return pool;
+}
+
+/**
+ * allocator drawing from the buffer pool. Elements which are value initialised, like the ones added
+ * by resize, are left uninitialised, so growing a buffer which is overwritten anyway costs nothing.
+ * Only meant for trivially copyable types.
+ */
+template<typename T>
+struct PoolAllocator {
+  using value_type = T;
+
+  PoolAllocator() = default;
+
+  template<typename U>
+  PoolAllocator(const PoolAllocator<U>&) {}
+
+  T* allocate(size_t n) {
+    T* p = (T*) buffer_pool().allocate(n * sizeof(T));
+    if (p == nullptr)
+      throw std::bad_alloc();
+    return p;
+  }
+
+  void deallocate(T* p, size_t n) {
+    buffer_pool().release(p, n * sizeof(T));
+  }
+
+  template<typename U>
+  void construct(U*) noexcept {
+    static_assert(std::is_trivially_copyable<U>::value, "only trivially copyable types can be left uninitialised");
+  }
+
+  template<typename U, typename... Args>
+  void construct(U* p, Args&&... args) {
+    ::new ((void*) p) U(std::forward<Args>(args)...);
+  }
+
+  template<typename U>
+  bool operator==(const PoolAllocator<U>&) const {
+    return true;
+  }
+
+  template<typename U>
+  bool operator!=(const PoolAllocator<U>&) const {
+    return false;
+  }
+};
+
+#endif
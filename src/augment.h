@@ -0,0 +1,139 @@
+#ifndef AUGMENT_H
+#define AUGMENT_H
+
+#include <cstdint>
+#include <vector>
+
+#include "bitboard.h"
+#include "hash.h"
+#include "position.h"
+
+/**
+ * symmetries of positions used to augment the data. Mirroring swaps the files a and h and drops the
+ * castling rights, which have no mirrored counterpart. Flipping swaps the colors and the ranks, so
+ * the position is seen from the other side: the side to move, the castling rights, the en passant
+ * square and the white relative score and result change accordingly.
+ *
+ * Since the pieces are stored in the order of their squares, each rank holds a contiguous run of at
+ * most 8 nibbles. Mirroring reverses the nibbles within each run, flipping reverses the order of the
+ * runs and toggles the color bit of each nibble.
+ */
+#define AUGMENT_MIRROR (1)
+#define AUGMENT_FLIP   (2)
+#define AUGMENT_ALL    (AUGMENT_MIRROR | AUGMENT_FLIP)
+
+/**
+ * reverses the bits within each byte, i.e. swaps the files of a bitboard.
+ */
+inline BB mirror_bb(BB bb) {
+  bb = ((bb >> 1) & 0x5555555555555555ULL) | ((bb & 0x5555555555555555ULL) << 1);
+  bb = ((bb >> 2) & 0x3333333333333333ULL) | ((bb & 0x3333333333333333ULL) << 2);
+  return ((bb >> 4) & 0x0F0F0F0F0F0F0F0FULL) | ((bb & 0x0F0F0F0F0F0F0F0FULL) << 4);
+}
+
+/**
+ * reverses the bytes, i.e. swaps the ranks of a bitboard.
+ */
+inline BB flip_bb(BB bb) {
+  return __builtin_bswap64(bb);
+}
+
+/**
+ * reverses the order of the lowest count nibbles.
+ */
+inline uint32_t reverse_nibbles(uint32_t x, int count) {
+  x = __builtin_bswap32(x);
+  x = ((x >> 4) & 0x0F0F0F0FU) | ((x & 0x0F0F0F0FU) << 4);
+  return (uint64_t) x >> (4 * (8 - count));
+}
+
+/**
+ * applies the given combination of AUGMENT_MIRROR and AUGMENT_FLIP to the position.
+ */
+inline void augment(Position& p, uint32_t transforms) {
+  const bool mirror = transforms & AUGMENT_MIRROR;
+  const bool flip   = transforms & AUGMENT_FLIP;
+  if (!mirror && !flip)
+    return;
+
+  // cut the pieces into runs of one rank each
+  const NibbleList in = load_nibbles(p.m_pieces);
+  uint32_t runs[8];
+  int counts[8];
+  int shift = 0;
+  for (int r = 0; r < 8; r++) {
+    counts[r]           = bit_count((p.m_occupancy >> (8 * r)) & 0xFF);
+    const uint32_t mask = ((uint64_t) 1 << (4 * counts[r])) - 1;
+    runs[r]             = counts[r] > 0 ? (uint32_t) (in >> shift) & mask : 0;
+    shift += 4 * counts[r];
+    if (mirror)
+      runs[r] = reverse_nibbles(runs[r], counts[r]);
+    if (flip)
+      runs[r] ^= 0x88888888U & mask;
+  }
+
+  NibbleList out = 0;
+  shift          = 0;
+  for (int i = 0; i < 8; i++) {
+    const int r = flip ? 7 - i : i;
+    out |= (NibbleList) runs[r] << shift;
+    shift += 4 * counts[r];
+  }
+  store_nibbles(p.m_pieces, out);
+
+  uint8_t& meta = p.m_meta.m_castling_and_active_player;
+  Square ep     = p.m_meta.m_en_passant_square;
+  if (mirror) {
+    p.m_occupancy = mirror_bb(p.m_occupancy);
+    meta &= ~0x0F;
+    if (ep != N_SQUARES)
+      ep ^= 7;
+  }
+  if (flip) {
+    p.m_occupancy = flip_bb(p.m_occupancy);
+    meta          = (meta & 0x70) | (~meta & 0x80) | ((meta & 0x3) << 2) | ((meta >> 2) & 0x3);
+    if (ep != N_SQUARES)
+      ep ^= 56;
+    p.m_result.score = -std::max<int16_t>(p.m_result.score, -INT16_MAX);
+    p.m_result.wdl   = -p.m_result.wdl;
+  }
+  p.m_meta.m_en_passant_square = ep;
+}
+
+/**
+ * amount of positions written per input position by augment_all.
+ */
+inline int augment_variants(uint32_t transforms) {
+  return 1 << bit_count(transforms & AUGMENT_ALL);
+}
+
+/**
+ * writes each position followed by all its variants under the subsets of the given transforms into
+ * the output, which needs room for count * augment_variants(transforms) positions. Does not split the
+ * work across threads.
+ */
+inline void augment_all(const Position* positions, size_t count, uint32_t transforms, Position* out) {
+  transforms &= AUGMENT_ALL;
+  const int variants = augment_variants(transforms);
+
+  for (size_t i = 0; i < count; i++) {
+    Position* o = out + i * variants;
+    for (uint32_t subset = 0, v = 0; subset <= transforms; subset++) {
+      if ((subset & transforms) != subset)
+        continue;
+      o[v] = positions[i];
+      augment(o[v++], subset);
+    }
+  }
+}
+
+/**
+ * applies a random subset of the given transforms to each position. The subset only depends on the
+ * seed and the index of the position.
+ */
+inline void augment_random(Position* positions, size_t count, uint32_t transforms, uint64_t seed) {
+  for (size_t i = 0; i < count; i++)
+    augment(positions[i], mix_hash(seed ^ mix_hash(i)) & transforms);
+}
+
+#endif
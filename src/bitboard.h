@@ -3,6 +3,27 @@
 
 #include "defs.h"
 
+/**
+ * compiles the function once for cpus supporting bmi2 and once without, the matching version is
+ * selected at load time.
+ */
+#define BMI2_CLONES __attribute__((target_clones("bmi2", "default")))
+
+/**
+ * whether pdep and pext are available and fast. Zen 1 and 2 implement them in microcode whose
+ * latency grows with the amount of set bits in the mask, so the fallbacks are faster there.
+ */
+inline bool has_fast_bmi2() {
+#if defined(__x86_64__)
+  static const bool fast =
+    __builtin_cpu_supports("bmi2") && __builtin_cpu_supports("popcnt") && !__builtin_cpu_is("znver1")
+    && !__builtin_cpu_is("znver2");
+  return fast;
+#else
+  return false;
+#endif
+}
+
 inline void set_bit(BB& number, Square index) {
   number |= (1ULL << index);
 }
@@ -0,0 +1,659 @@
+#ifndef BLOCKFILE_H
+#define BLOCKFILE_H
+
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "blockstats.h"
+#include "columns.h"
+#include "crc32c.h"
+#include "dataset.h"
+#include "delta.h"
+#include "entropy.h"
+#include "packed.h"
+#include "position.h"
+#include "progress.h"
+#include "threads.h"
+
+/**
+ * block compressed fin files (.finz) store the positions in independently compressed blocks of a
+ * fixed amount of positions. The layout is
+ *
+ *    BlockFileHeader | block 0 | block 1 | ... | BlockIndexEntry[block_count] | checksums[block_count]
+ *    | BlockStats[block_count] | BlockChecksums | BlockFooter
+ *
+ * The index in the footer allows random access to each block and parallel decompression. Each block
+ * is protected by the crc32c of its stored bytes, and BlockChecksums protects the header and the
+ * index, which includes the block stats. Files of version 1 do not contain the checksums, files of
+ * version 2 do not contain the block stats.
+ * Entropy coded files additionally store their EntropyModel directly in front of the index.
+ * Blocks of columnar files start at a multiple of COLUMN_ALIGNMENT.
+ * Raw fin files start with the 64 bit position count, which can never equal the magic.
+ */
+#define BLOCK_MAGIC      "FINBLOCK"
+#define BLOCK_VERSION    (3)
+#define BLOCK_POSITIONS  (1 << 16)
+#define BLOCK_EXTENSION  ".finz"
+
+enum BlockCompression : uint32_t {
+  BLOCK_UNCOMPRESSED = 0,
+  BLOCK_ZLIB         = 1
+};
+
+enum BlockEncoding : uint32_t {
+  BLOCK_ROWS    = 0,
+  BLOCK_PACKED  = 1,
+  BLOCK_DELTA   = 2,
+  BLOCK_ENTROPY = 3,
+  BLOCK_COLUMNS = 4
+};
+
+struct BlockFileHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t compression;
+  uint32_t block_size;
+  uint32_t encoding;
+  Header header;
+};
+
+struct BlockIndexEntry {
+  uint64_t offset;
+  uint32_t size;
+  uint32_t count;
+};
+
+struct BlockChecksums {
+  uint32_t header;
+  uint32_t index;
+};
+
+struct BlockFooter {
+  uint64_t index_offset;
+  uint64_t block_count;
+  char magic[8];
+};
+
+struct BlockOptions {
+  BlockCompression compression = BLOCK_ZLIB;
+  BlockEncoding encoding       = BLOCK_PACKED;
+  int level                    = 1;
+  uint32_t block_size          = BLOCK_POSITIONS;
+};
+
+/**
+ * returns a reference to the flag which enables the verification of the block checksums whenever
+ * a block is read.
+ */
+inline bool& verify_reads() {
+  static bool verify = false;
+  return verify;
+}
+
+/**
+ * returns true if the file name asks for the block compressed format.
+ */
+inline bool is_block_file_name(const std::string& file) {
+  const std::string extension = BLOCK_EXTENSION;
+  return file.size() >= extension.size()
+         && file.compare(file.size() - extension.size(), extension.size(), extension) == 0;
+}
+
+/**
+ * returns true if the file starts with the block file magic.
+ */
+inline bool is_block_file(FILE* f) {
+  char magic[8] {};
+  long pos    = ftell(f);
+  bool result = fread(magic, sizeof(magic), 1, f) == 1 && std::memcmp(magic, BLOCK_MAGIC, sizeof(magic)) == 0;
+  fseek(f, pos, SEEK_SET);
+  return result;
+}
+
+/**
+ * parses the name of an encoding as used on the command line.
+ * @return false if the name is unknown
+ */
+inline bool parse_block_encoding(const std::string& name, BlockEncoding& encoding) {
+  static const std::pair<const char*, BlockEncoding> names[] = {
+      {"rows", BLOCK_ROWS},
+      {"packed", BLOCK_PACKED},
+      {"delta", BLOCK_DELTA},
+      {"entropy", BLOCK_ENTROPY},
+      {"columns", BLOCK_COLUMNS}};
+  for (const auto& [n, e] : names) {
+    if (name == n) {
+      encoding = e;
+      return true;
+    }
+  }
+  return false;
+}
+
+/**
+ * upper bound of the size of count encoded positions, including the padding required for decoding.
+ */
+inline size_t max_encoded_size(uint32_t encoding, size_t count) {
+  if (encoding == BLOCK_ENTROPY)
+    return ENTROPY_MAX_SIZE(count);
+  return count * sizeof(Position) + PACKED_PADDING;
+}
+
+/**
+ * encodes and compresses count positions into the output buffer. The tables are only required
+ * for the entropy encoding.
+ */
+inline void compress_block(const Position* positions,
+                           size_t count,
+                           const BlockOptions& options,
+                           std::vector<uint8_t>& out,
+                           const EntropyTables* tables = nullptr) {
+  // columns are compressed individually
+  if (options.encoding == BLOCK_COLUMNS) {
+    encode_columns(positions, count, options.compression == BLOCK_UNCOMPRESSED ? -1 : options.level, out);
+    return;
+  }
+
+  std::vector<uint8_t> encoded {};
+  const uint8_t* data = (const uint8_t*) positions;
+  size_t bytes        = count * sizeof(Position);
+
+  if (options.encoding != BLOCK_ROWS) {
+    if (options.encoding == BLOCK_PACKED)
+      encode_packed(positions, count, encoded);
+    else if (options.encoding == BLOCK_DELTA)
+      encode_delta(positions, count, encoded);
+    else if (!encode_entropy(positions, count, *tables, encoded))
+      encode_entropy_raw(positions, count, encoded);
+    data  = encoded.data();
+    bytes = encoded.size();
+  }
+
+  if (options.compression == BLOCK_UNCOMPRESSED) {
+    out.assign(data, data + bytes);
+    return;
+  }
+  uLongf size = compressBound(bytes);
+  out.resize(size);
+  compress2(out.data(), &size, data, bytes, options.level);
+  out.resize(size);
+}
+
+/**
+ * decompresses and decodes a block into count positions.
+ * @return false if the block is corrupted
+ */
+inline bool decompress_block(const std::vector<uint8_t>& in,
+                             const BlockFileHeader& file_header,
+                             Position* positions,
+                             size_t count,
+                             const EntropyTables* tables = nullptr) {
+  const size_t bytes = count * sizeof(Position);
+
+  if (file_header.encoding == BLOCK_COLUMNS) {
+    std::fill(positions, positions + count, Position {});
+    return decode_columns(in.data(), in.size(), file_header.compression != BLOCK_UNCOMPRESSED, COLUMN_ALL,
+                          positions, count);
+  }
+
+  if (file_header.encoding == BLOCK_ROWS) {
+    if (file_header.compression == BLOCK_UNCOMPRESSED) {
+      if (in.size() != bytes)
+        return false;
+      std::memcpy(positions, in.data(), bytes);
+      return true;
+    }
+    uLongf size = bytes;
+    return uncompress((Bytef*) positions, &size, in.data(), in.size()) == Z_OK && size == bytes;
+  }
+
+  auto decode = [&](const uint8_t* data, size_t size) {
+    if (file_header.encoding == BLOCK_PACKED)
+      return decode_packed(data, size, positions, count);
+    if (file_header.encoding == BLOCK_DELTA)
+      return decode_delta(data, size, positions, count);
+    if (file_header.encoding == BLOCK_ENTROPY && tables != nullptr)
+      return decode_entropy(data, size, *tables, positions, count);
+    return false;
+  };
+
+  if (file_header.compression == BLOCK_UNCOMPRESSED) {
+    std::vector<uint8_t> padded(in.size() + PACKED_PADDING);
+    std::memcpy(padded.data(), in.data(), in.size());
+    return decode(padded.data(), in.size());
+  }
+
+  std::vector<uint8_t> decoded(max_encoded_size(file_header.encoding, count));
+  uLongf size = decoded.size() - PACKED_PADDING;
+  return uncompress(decoded.data(), &size, in.data(), in.size()) == Z_OK && decode(decoded.data(), size);
+}
+
+/**
+ * writer for block compressed fin files. Positions are collected until one block per thread is
+ * full, which are then compressed in parallel and appended in order. Once a write fails, the
+ * writer is failed and the output incomplete.
+ */
+struct BlockWriter {
+  FILE* f = nullptr;
+  BlockFileHeader file_header {};
+  BlockOptions options;
+  std::vector<BlockIndexEntry> index {};
+  std::vector<uint32_t> checksums {};
+  std::vector<BlockStats> stats {};
+  std::vector<Position> pending {};
+  uint64_t offset      = sizeof(BlockFileHeader);
+  bool failed          = false;
+  StageCounters& stage = progress_stage("write");
+
+  // the entropy model is trained on the first batch of positions
+  std::unique_ptr<EntropyModel> model {};
+  std::unique_ptr<EntropyTables> tables {};
+
+  BlockWriter(const std::string& file, const BlockOptions& p_options, const Header& header = Header {}) :
+      options(p_options) {
+    f = fopen(file.c_str(), "wb");
+    if (f == nullptr) {
+      std::cout << "could not open: " << file << std::endl;
+      return;
+    }
+    std::memcpy(file_header.magic, BLOCK_MAGIC, sizeof(file_header.magic));
+    file_header.version     = BLOCK_VERSION;
+    file_header.compression = options.compression;
+    file_header.encoding    = options.encoding;
+    file_header.block_size  = options.block_size;
+    file_header.header      = header;
+
+    // the position count is accumulated while writing blocks
+    file_header.header.position_count = 0;
+    failed = fwrite(&file_header, sizeof(BlockFileHeader), 1, f) != 1;
+    if (options.encoding == BLOCK_COLUMNS)
+      pad(align_column(offset) - offset);
+    pending.reserve(batch_size());
+  }
+
+  BlockWriter(const BlockWriter&)            = delete;
+  BlockWriter& operator=(const BlockWriter&) = delete;
+
+  ~BlockWriter() {
+    close();
+  }
+
+  bool is_open() const {
+    return f != nullptr;
+  }
+
+  size_t batch_size() const {
+    return (size_t) options.block_size * thread_count();
+  }
+
+  uint64_t position_count() const {
+    return file_header.header.position_count + pending.size();
+  }
+
+  void write(const Position* positions, size_t count) {
+    while (count > 0) {
+      size_t n = std::min(count, batch_size() - pending.size());
+      pending.insert(pending.end(), positions, positions + n);
+      positions += n;
+      count -= n;
+      if (pending.size() >= batch_size())
+        flush();
+    }
+  }
+
+  void write(const Position& position) {
+    write(&position, 1);
+  }
+
+  /**
+   * compresses all pending positions into blocks and writes them. Only the last block of the
+   * file may contain less than block_size positions, so this is only called on full batches
+   * and when closing.
+   */
+  void flush() {
+    if (f == nullptr || pending.empty())
+      return;
+    if (options.encoding == BLOCK_ENTROPY && model == nullptr)
+      train(pending.data(), pending.size());
+
+    const size_t blocks = (pending.size() + options.block_size - 1) / options.block_size;
+    std::vector<std::vector<uint8_t>> compressed(blocks);
+    std::vector<uint32_t> crcs(blocks);
+    std::vector<BlockStats> block_stats(blocks);
+
+    parallel_for(blocks, [&](size_t begin, size_t end, int) {
+      for (size_t b = begin; b < end; b++) {
+        size_t first = b * options.block_size;
+        size_t count = std::min<size_t>(options.block_size, pending.size() - first);
+        compress_block(&pending[first], count, options, compressed[b], tables.get());
+        crcs[b]        = crc32c(compressed[b].data(), compressed[b].size());
+        block_stats[b] = compute_block_stats(&pending[first], count);
+      }
+    });
+
+    for (size_t b = 0; b < blocks; b++) {
+      uint32_t count = std::min<size_t>(options.block_size, pending.size() - b * options.block_size);
+      failed |= fwrite(compressed[b].data(), 1, compressed[b].size(), f) != compressed[b].size();
+      stage.add(count, compressed[b].size());
+      index.push_back(BlockIndexEntry {offset, (uint32_t) compressed[b].size(), count});
+      checksums.push_back(crcs[b]);
+      stats.push_back(block_stats[b]);
+      offset += compressed[b].size();
+      file_header.header.position_count += count;
+    }
+    pending.clear();
+  }
+
+  /**
+   * writes the given amount of zero bytes.
+   */
+  void pad(size_t bytes) {
+    static const uint8_t zeros[COLUMN_ALIGNMENT] {};
+    failed |= fwrite(zeros, 1, bytes, f) != bytes;
+    offset += bytes;
+  }
+
+  void train(const Position* positions, size_t count) {
+    model  = std::make_unique<EntropyModel>(train_entropy_model(positions, count));
+    tables = std::make_unique<EntropyTables>(*model);
+  }
+
+  /**
+   * writes the remaining blocks and the trailer and patches the header.
+   * @return false if any write failed
+   */
+  bool close() {
+    if (f == nullptr)
+      return !failed;
+    flush();
+
+    if (options.encoding == BLOCK_ENTROPY) {
+      if (model == nullptr)
+        train(nullptr, 0);
+      failed |= fwrite(model.get(), sizeof(EntropyModel), 1, f) != 1;
+      offset += sizeof(EntropyModel);
+    }
+
+    BlockChecksums crc {};
+    crc.header = crc32c(&file_header, sizeof(BlockFileHeader));
+    crc.index  = crc32c(index.data(), index.size() * sizeof(BlockIndexEntry));
+    crc.index  = crc32c(checksums.data(), checksums.size() * sizeof(uint32_t), crc.index);
+    crc.index  = crc32c(stats.data(), stats.size() * sizeof(BlockStats), crc.index);
+
+    BlockFooter footer {offset, index.size(), {}};
+    std::memcpy(footer.magic, BLOCK_MAGIC, sizeof(footer.magic));
+    failed |= fwrite(index.data(), sizeof(BlockIndexEntry), index.size(), f) != index.size();
+    failed |= fwrite(checksums.data(), sizeof(uint32_t), checksums.size(), f) != checksums.size();
+    failed |= fwrite(stats.data(), sizeof(BlockStats), stats.size(), f) != stats.size();
+    failed |= fwrite(&crc, sizeof(BlockChecksums), 1, f) != 1;
+    failed |= fwrite(&footer, sizeof(BlockFooter), 1, f) != 1;
+
+    failed |= fseek(f, 0, SEEK_SET) != 0 || fwrite(&file_header, sizeof(BlockFileHeader), 1, f) != 1;
+    failed |= fclose(f) != 0;
+    f = nullptr;
+    return !failed;
+  }
+};
+
+/**
+ * reader for block compressed fin files. Blocks can be read individually through read_block,
+ * which is safe to call from multiple threads, or sequentially through read, which decompresses
+ * one block per thread at a time.
+ */
+struct BlockReader {
+  FILE* f = nullptr;
+  BlockFileHeader file_header {};
+  std::vector<BlockIndexEntry> index {};
+  std::vector<uint32_t> checksums {};
+  std::vector<BlockStats> stats {};
+  std::unique_ptr<EntropyTables> tables {};
+
+  // checks the crc of each block before decompressing it
+  bool verify = verify_reads();
+
+  // members of the positions to read from columnar files, the others are left zero
+  uint32_t columns = COLUMN_ALL;
+
+  // state of the sequential reader
+  size_t next_block = 0;
+  std::vector<Position> buffer {};
+  size_t buffer_offset = 0;
+
+  explicit BlockReader(const std::string& file) {
+    f = fopen(file.c_str(), "rb");
+    if (f == nullptr)
+      return;
+
+    BlockFooter footer {};
+    bool valid = fread(&file_header, sizeof(BlockFileHeader), 1, f) == 1
+                 && std::memcmp(file_header.magic, BLOCK_MAGIC, sizeof(file_header.magic)) == 0
+                 && file_header.version >= 1 && file_header.version <= BLOCK_VERSION
+                 && fseek(f, -(long) sizeof(BlockFooter), SEEK_END) == 0
+                 && fread(&footer, sizeof(BlockFooter), 1, f) == 1
+                 && std::memcmp(footer.magic, BLOCK_MAGIC, sizeof(footer.magic)) == 0;
+
+    // the footer has no checksum, so its block count must account for exactly the bytes after the
+    // index offset before anything is allocated for it
+    if (valid) {
+      const uint64_t entry_size = sizeof(BlockIndexEntry) + (file_header.version >= 2 ? sizeof(uint32_t) : 0)
+                                  + (file_header.version >= 3 ? sizeof(BlockStats) : 0);
+      const uint64_t trailer_size = (file_header.version >= 2 ? sizeof(BlockChecksums) : 0) + sizeof(BlockFooter);
+      struct stat st {};
+      valid = fstat(fileno(f), &st) == 0 && footer.index_offset >= sizeof(BlockFileHeader)
+              && footer.index_offset + trailer_size <= (uint64_t) st.st_size
+              && footer.block_count <= ((uint64_t) st.st_size - footer.index_offset - trailer_size) / entry_size
+              && footer.index_offset + footer.block_count * entry_size + trailer_size == (uint64_t) st.st_size;
+    }
+
+    if (valid) {
+      index.resize(footer.block_count);
+      valid = fseek(f, footer.index_offset, SEEK_SET) == 0
+              && fread(index.data(), sizeof(BlockIndexEntry), index.size(), f) == index.size();
+    }
+
+    if (valid && file_header.version >= 2) {
+      BlockChecksums crc {};
+      checksums.resize(index.size());
+      stats.resize(file_header.version >= 3 ? index.size() : 0);
+      valid = fread(checksums.data(), sizeof(uint32_t), checksums.size(), f) == checksums.size()
+              && fread(stats.data(), sizeof(BlockStats), stats.size(), f) == stats.size()
+              && fread(&crc, sizeof(BlockChecksums), 1, f) == 1;
+
+      uint32_t index_crc = crc32c(index.data(), index.size() * sizeof(BlockIndexEntry));
+      index_crc          = crc32c(checksums.data(), checksums.size() * sizeof(uint32_t), index_crc);
+      index_crc          = crc32c(stats.data(), stats.size() * sizeof(BlockStats), index_crc);
+      if (valid && (crc.header != crc32c(&file_header, sizeof(BlockFileHeader)) || crc.index != index_crc)) {
+        std::cout << "checksum mismatch in header or index of: " << file << std::endl;
+        valid = false;
+      }
+    }
+
+    // blocks hold at most block_size positions, which together make up the positions of the header
+    if (valid) {
+      uint64_t total = 0;
+      for (const BlockIndexEntry& entry : index) {
+        valid = valid && entry.count <= file_header.block_size && entry.offset <= footer.index_offset
+                && entry.size <= footer.index_offset - entry.offset;
+        total += entry.count;
+      }
+      valid = valid && total == file_header.header.position_count;
+    }
+
+    if (valid && file_header.encoding == BLOCK_ENTROPY) {
+      EntropyModel model {};
+      valid = footer.index_offset >= sizeof(BlockFileHeader) + sizeof(EntropyModel)
+              && pread(fileno(f), &model, sizeof(EntropyModel), footer.index_offset - sizeof(EntropyModel))
+                     == (ssize_t) sizeof(EntropyModel);
+      if (valid)
+        tables = std::make_unique<EntropyTables>(model);
+    }
+
+    if (!valid) {
+      std::cout << "invalid or truncated block file: " << file << std::endl;
+      fclose(f);
+      f = nullptr;
+    }
+  }
+
+  BlockReader(const BlockReader&)            = delete;
+  BlockReader& operator=(const BlockReader&) = delete;
+
+  ~BlockReader() {
+    if (f != nullptr)
+      fclose(f);
+  }
+
+  bool is_open() const {
+    return f != nullptr;
+  }
+
+  const Header& header() const {
+    return file_header.header;
+  }
+
+  size_t block_count() const {
+    return index.size();
+  }
+
+  bool has_checksums() const {
+    return file_header.version >= 2;
+  }
+
+  bool has_stats() const {
+    return file_header.version >= 3;
+  }
+
+  /**
+   * reads the stored bytes of the given block without decompressing them.
+   */
+  bool read_raw_block(size_t block, std::vector<uint8_t>& data) const {
+    const BlockIndexEntry& entry = index[block];
+    data.resize(entry.size);
+    return pread(fileno(f), data.data(), entry.size, entry.offset) == (ssize_t) entry.size;
+  }
+
+  /**
+   * checks the stored bytes of the given block against its checksum. Always succeeds for files
+   * without checksums.
+   */
+  bool check_block(size_t block, const std::vector<uint8_t>& data) const {
+    return checksums.empty() || crc32c(data.data(), data.size()) == checksums[block];
+  }
+
+  /**
+   * index of the first position of the given block.
+   */
+  uint64_t block_start(size_t block) const {
+    return (uint64_t) block * file_header.block_size;
+  }
+
+  /**
+   * reads and decompresses the given block into positions.
+   * @return false if the block could not be read or is corrupted
+   */
+  bool read_block(size_t block, std::vector<Position>& positions) const {
+    positions.resize(index[block].count);
+    return read_block(block, positions.data());
+  }
+
+  /**
+   * reads and decompresses the given block into the memory pointed to, which must have room for
+   * the amount of positions stored in the block.
+   */
+  bool read_block(size_t block, Position* positions) const {
+    const BlockIndexEntry& entry = index[block];
+    if (file_header.encoding == BLOCK_COLUMNS && columns != COLUMN_ALL && !verify)
+      return read_columns(entry, positions);
+
+    // verification needs the whole block, so column pruning is skipped
+    std::vector<uint8_t> compressed {};
+    return read_raw_block(block, compressed) && (!verify || check_block(block, compressed))
+           && decompress_block(compressed, file_header, positions, entry.count, tables.get());
+  }
+
+  /**
+   * reads only the selected column sections of a columnar block.
+   */
+  bool read_columns(const BlockIndexEntry& entry, Position* positions) const {
+    uint32_t sizes[COLUMN_COUNT];
+    size_t offsets[COLUMN_COUNT + 1];
+    if (entry.size < COLUMN_ALIGNMENT || pread(fileno(f), sizes, sizeof(sizes), entry.offset) != sizeof(sizes))
+      return false;
+    column_section_offsets(sizes, offsets);
+    if (offsets[COLUMN_COUNT] > entry.size)
+      return false;
+
+    std::fill(positions, positions + entry.count, Position {});
+    std::vector<uint8_t> section {};
+    for (int c = 0; c < COLUMN_COUNT; c++) {
+      if (!(columns & (1 << c)))
+        continue;
+      section.resize(sizes[c]);
+      if (pread(fileno(f), section.data(), sizes[c], entry.offset + offsets[c]) != (ssize_t) sizes[c]
+          || !decode_column(section.data(), sizes[c], file_header.compression != BLOCK_UNCOMPRESSED, c, positions,
+                            entry.count))
+        return false;
+    }
+    return true;
+  }
+
+  /**
+   * reads up to count positions sequentially into the given buffer and resizes it to the amount read.
+   */
+  size_t read(std::vector<Position>& positions, size_t count) {
+    positions.clear();
+    while (positions.size() < count) {
+      if (buffer_offset == buffer.size() && !fill_buffer())
+        break;
+      size_t n = std::min(count - positions.size(), buffer.size() - buffer_offset);
+      positions.insert(positions.end(), buffer.begin() + buffer_offset, buffer.begin() + buffer_offset + n);
+      buffer_offset += n;
+    }
+    return positions.size();
+  }
+
+  /**
+   * decompresses the next batch of blocks, one per thread, into the internal buffer.
+   */
+  bool fill_buffer() {
+    size_t blocks = std::min<size_t>(thread_count(), index.size() - next_block);
+    if (blocks == 0)
+      return false;
+
+    // decompress each block directly into its place within the buffer
+    std::vector<size_t> offsets {0};
+    for (size_t b = 0; b < blocks; b++)
+      offsets.push_back(offsets.back() + index[next_block + b].count);
+    buffer.resize(offsets.back());
+    buffer_offset = 0;
+
+    std::atomic<bool> valid {true};
+    parallel_for(blocks, [&](size_t begin, size_t end, int) {
+      for (size_t b = begin; b < end; b++)
+        if (!read_block(next_block + b, &buffer[offsets[b]]))
+          valid = false;
+    });
+
+    if (!valid) {
+      std::cout << "corrupted block within [" << next_block << ", " << next_block + blocks << ")" << std::endl;
+      next_block = index.size();
+      buffer.clear();
+      return false;
+    }
+    next_block += blocks;
+    return true;
+  }
+};
+
+#endif
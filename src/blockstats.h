@@ -0,0 +1,114 @@
+#ifndef BLOCKSTATS_H
+#define BLOCKSTATS_H
+
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+
+#include "position.h"
+
+/**
+ * summary of the positions within a block, stored next to the block index. Allows skipping blocks
+ * which cannot contain positions matching a filter, and answering counts of blocks which only
+ * contain matching positions without reading them. Summaries of whole datasets use 64 bit counts.
+ */
+template<typename Count>
+struct PositionStats {
+  uint8_t min_pieces = std::numeric_limits<uint8_t>::max();
+  uint8_t max_pieces = 0;
+  int16_t min_score  = std::numeric_limits<int16_t>::max();
+  int16_t max_score  = std::numeric_limits<int16_t>::min();
+  uint16_t reserved  = 0;
+  // counts of losses, draws and wins
+  Count wdl[3] {};
+  // counts of white and black to move
+  Count stm[2] {};
+
+  uint64_t count() const {
+    return (uint64_t) stm[0] + stm[1];
+  }
+
+  void add(const Position& p) {
+    const uint8_t pieces = p.get_piece_count();
+    min_pieces           = std::min(min_pieces, pieces);
+    max_pieces           = std::max(max_pieces, pieces);
+    min_score            = std::min(min_score, p.m_result.score);
+    max_score            = std::max(max_score, p.m_result.score);
+    wdl[std::clamp<int>(p.m_result.wdl + 1, 0, 2)]++;
+    stm[p.m_meta.get_active_player()]++;
+  }
+
+  template<typename OtherCount>
+  void merge(const PositionStats<OtherCount>& other) {
+    min_pieces = std::min(min_pieces, other.min_pieces);
+    max_pieces = std::max(max_pieces, other.max_pieces);
+    min_score  = std::min(min_score, other.min_score);
+    max_score  = std::max(max_score, other.max_score);
+    for (int i = 0; i < 3; i++)
+      wdl[i] += other.wdl[i];
+    for (int i = 0; i < 2; i++)
+      stm[i] += other.stm[i];
+  }
+};
+
+using BlockStats   = PositionStats<uint32_t>;
+using DatasetStats = PositionStats<uint64_t>;
+
+static_assert(sizeof(BlockStats) == 28, "block stats are stored as is");
+
+inline BlockStats compute_block_stats(const Position* positions, size_t count) {
+  BlockStats stats {};
+  for (size_t i = 0; i < count; i++)
+    stats.add(positions[i]);
+  return stats;
+}
+
+/**
+ * predicate on the piece count, score, wdl and side to move of positions. The wdl and stm masks
+ * contain one bit per allowed value, indexed like the counts of BlockStats.
+ */
+struct PositionFilter {
+  int min_pieces = 0;
+  int max_pieces = MAX_PIECES_PER_BOARD;
+  int min_score  = std::numeric_limits<int16_t>::min();
+  int max_score  = std::numeric_limits<int16_t>::max();
+  uint32_t wdl   = 0b111;
+  uint32_t stm   = 0b11;
+
+  bool matches(const Position& p) const {
+    const int pieces = p.get_piece_count();
+    return pieces >= min_pieces && pieces <= max_pieces && p.m_result.score >= min_score
+           && p.m_result.score <= max_score && (wdl & (1 << std::clamp<int>(p.m_result.wdl + 1, 0, 2)))
+           && (stm & (1 << p.m_meta.get_active_player()));
+  }
+
+  /**
+   * returns false if no position summarised by the stats can match.
+   */
+  bool may_match(const BlockStats& s) const {
+    bool any_wdl = false;
+    bool any_stm = false;
+    for (int i = 0; i < 3; i++)
+      any_wdl |= (wdl & (1 << i)) && s.wdl[i] > 0;
+    for (int i = 0; i < 2; i++)
+      any_stm |= (stm & (1 << i)) && s.stm[i] > 0;
+    return s.count() > 0 && s.max_pieces >= min_pieces && s.min_pieces <= max_pieces && s.max_score >= min_score
+           && s.min_score <= max_score && any_wdl && any_stm;
+  }
+
+  /**
+   * returns true if all positions summarised by the stats match.
+   */
+  bool matches_all(const BlockStats& s) const {
+    for (int i = 0; i < 3; i++)
+      if (!(wdl & (1 << i)) && s.wdl[i] > 0)
+        return false;
+    for (int i = 0; i < 2; i++)
+      if (!(stm & (1 << i)) && s.stm[i] > 0)
+        return false;
+    return s.min_pieces >= min_pieces && s.max_pieces <= max_pieces && s.min_score >= min_score
+           && s.max_score <= max_score;
+  }
+};
+
+#endif
@@ -0,0 +1,142 @@
+#ifndef COLUMNS_H
+#define COLUMNS_H
+
+#include <zlib.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include "position.h"
+
+/**
+ * columnar encoding of a sequence of positions. Each member of the position is stored as its own
+ * column section, so scans which only need some of the members can skip reading the others:
+ *
+ *    column sizes (4 bytes each) | pieces | occupancy | meta | result
+ *
+ * The directory and every section start at a multiple of COLUMN_ALIGNMENT relative to the start
+ * of the block. Sections are compressed on their own, so each of them can be read independently.
+ */
+#define COLUMN_COUNT     (4)
+#define COLUMN_ALIGNMENT (64)
+
+enum Column : uint32_t {
+  COLUMN_PIECES    = 1 << 0,
+  COLUMN_OCCUPANCY = 1 << 1,
+  COLUMN_META      = 1 << 2,
+  COLUMN_RESULT    = 1 << 3,
+  COLUMN_ALL       = (1 << COLUMN_COUNT) - 1
+};
+
+/**
+ * offset and width of each column within the position.
+ */
+constexpr size_t column_offset[COLUMN_COUNT] = {offsetof(Position, m_pieces),
+                                                offsetof(Position, m_occupancy),
+                                                offsetof(Position, m_meta),
+                                                offsetof(Position, m_result)};
+constexpr size_t column_width[COLUMN_COUNT]  = {sizeof(PieceList), sizeof(BB), sizeof(PositionMetaInformation),
+                                                sizeof(Result)};
+
+inline size_t align_column(size_t offset) {
+  return (offset + COLUMN_ALIGNMENT - 1) / COLUMN_ALIGNMENT * COLUMN_ALIGNMENT;
+}
+
+/**
+ * offsets of the column sections relative to the start of the block, computed from the directory.
+ * The last entry is the end of the final section.
+ */
+inline void column_section_offsets(const uint32_t* sizes, size_t* offsets) {
+  offsets[0] = COLUMN_ALIGNMENT;
+  for (int c = 0; c < COLUMN_COUNT; c++)
+    offsets[c + 1] = align_column(offsets[c] + sizes[c]);
+}
+
+/**
+ * encodes the positions into the output buffer. Each column is compressed using zlib with the
+ * given level, or stored as is if the level is negative.
+ */
+inline void encode_columns(const Position* positions, size_t count, int level, std::vector<uint8_t>& out) {
+  std::vector<uint8_t> sections[COLUMN_COUNT];
+  std::vector<uint8_t> column {};
+
+  for (int c = 0; c < COLUMN_COUNT; c++) {
+    column.resize(count * column_width[c]);
+    for (size_t i = 0; i < count; i++)
+      std::memcpy(&column[i * column_width[c]], (const uint8_t*) &positions[i] + column_offset[c], column_width[c]);
+
+    if (level < 0) {
+      sections[c].swap(column);
+      continue;
+    }
+    uLongf size = compressBound(column.size());
+    sections[c].resize(size);
+    compress2(sections[c].data(), &size, column.data(), column.size(), level);
+    sections[c].resize(size);
+  }
+
+  uint32_t sizes[COLUMN_COUNT];
+  for (int c = 0; c < COLUMN_COUNT; c++)
+    sizes[c] = sections[c].size();
+  size_t offsets[COLUMN_COUNT + 1];
+  column_section_offsets(sizes, offsets);
+
+  out.assign(offsets[COLUMN_COUNT], 0);
+  std::memcpy(out.data(), sizes, sizeof(sizes));
+  for (int c = 0; c < COLUMN_COUNT; c++)
+    std::memcpy(&out[offsets[c]], sections[c].data(), sections[c].size());
+}
+
+/**
+ * decodes a single column section into the corresponding member of count positions.
+ * @return false if the section is corrupted
+ */
+inline bool decode_column(const uint8_t* in, size_t size, bool compressed, int c, Position* positions, size_t count) {
+  const size_t bytes = count * column_width[c];
+  std::vector<uint8_t> column {};
+
+  if (compressed) {
+    column.resize(bytes);
+    uLongf decoded = bytes;
+    if (uncompress(column.data(), &decoded, in, size) != Z_OK || decoded != bytes)
+      return false;
+    in = column.data();
+  } else if (size != bytes) {
+    return false;
+  }
+
+  for (size_t i = 0; i < count; i++)
+    std::memcpy((uint8_t*) &positions[i] + column_offset[c], in + i * column_width[c], column_width[c]);
+  return true;
+}
+
+/**
+ * decodes the given columns of count positions from the buffer. Members of the positions which are
+ * not selected are left untouched.
+ * @return false if the buffer is corrupted
+ */
+inline bool decode_columns(const uint8_t* in,
+                           size_t size,
+                           bool compressed,
+                           uint32_t columns,
+                           Position* positions,
+                           size_t count) {
+  uint32_t sizes[COLUMN_COUNT];
+  if (size < COLUMN_ALIGNMENT)
+    return false;
+  std::memcpy(sizes, in, sizeof(sizes));
+
+  size_t offsets[COLUMN_COUNT + 1];
+  column_section_offsets(sizes, offsets);
+  if (offsets[COLUMN_COUNT] > size)
+    return false;
+
+  for (int c = 0; c < COLUMN_COUNT; c++)
+    if ((columns & (1 << c)) && !decode_column(in + offsets[c], sizes[c], compressed, c, positions, count))
+      return false;
+  return true;
+}
+
+#endif
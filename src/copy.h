@@ -0,0 +1,55 @@
+#ifndef COPY_H
+#define COPY_H
+
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <vector>
+
+/**
+ * kernel side copies of byte ranges between files. Ranges are copied with copy_file_range which
+ * avoids moving the data through user space. Filesystems not supporting it fall back to a plain
+ * pread / pwrite loop.
+ */
+#define COPY_CHUNK_SIZE  (1 << 30)
+#define COPY_BUFFER_SIZE (1 << 20)
+
+/**
+ * copies length bytes from in_offset of the input to out_offset of the output. Neither file
+ * offset is modified, so ranges of the same files can be copied from multiple threads.
+ * @return false if the range could not be copied completely
+ */
+inline bool copy_range(int in, off_t in_offset, int out, off_t out_offset, uint64_t length) {
+  if (length == 0)
+    return true;
+
+  while (length > 0) {
+    ssize_t copied = copy_file_range(in, &in_offset, out, &out_offset, std::min<uint64_t>(length, COPY_CHUNK_SIZE), 0);
+    if (copied > 0) {
+      length -= copied;
+      continue;
+    }
+    if (copied == 0)
+      return false;
+    if (errno == EINTR)
+      continue;
+    if (errno != EXDEV && errno != ENOSYS && errno != EINVAL && errno != EOPNOTSUPP)
+      return false;
+
+    // not supported between these files, copy through a buffer
+    std::vector<char> buffer(COPY_BUFFER_SIZE);
+    while (length > 0) {
+      ssize_t bytes = pread(in, buffer.data(), std::min<uint64_t>(length, buffer.size()), in_offset);
+      if (bytes <= 0 || pwrite(out, buffer.data(), bytes, out_offset) != bytes)
+        return false;
+      in_offset += bytes;
+      out_offset += bytes;
+      length -= bytes;
+    }
+  }
+  return true;
+}
+
+#endif
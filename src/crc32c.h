@@ -0,0 +1,78 @@
+#ifndef CRC32C_H
+#define CRC32C_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+#endif
+
+/**
+ * crc32c (castagnoli) checksums. The sse4.2 crc32 instruction is used if the cpu supports it,
+ * otherwise a table driven implementation which processes 8 bytes at a time.
+ */
+#define CRC32C_POLYNOMIAL (0x82F63B78u)
+
+struct Crc32cTable {
+  uint32_t table[8][256];
+
+  Crc32cTable() {
+    for (uint32_t i = 0; i < 256; i++) {
+      uint32_t crc = i;
+      for (int b = 0; b < 8; b++)
+        crc = crc & 1 ? (crc >> 1) ^ CRC32C_POLYNOMIAL : crc >> 1;
+      table[0][i] = crc;
+    }
+    for (uint32_t i = 0; i < 256; i++)
+      for (int k = 1; k < 8; k++)
+        table[k][i] = (table[k - 1][i] >> 8) ^ table[0][table[k - 1][i] & 0xFF];
+  }
+};
+
+inline uint32_t crc32c_software(uint32_t crc, const uint8_t* data, size_t size) {
+  static const Crc32cTable t {};
+
+  for (; size >= 8; size -= 8, data += 8) {
+    uint64_t word;
+    std::memcpy(&word, data, sizeof(word));
+    word ^= crc;
+    crc = t.table[7][word & 0xFF] ^ t.table[6][(word >> 8) & 0xFF] ^ t.table[5][(word >> 16) & 0xFF]
+          ^ t.table[4][(word >> 24) & 0xFF] ^ t.table[3][(word >> 32) & 0xFF] ^ t.table[2][(word >> 40) & 0xFF]
+          ^ t.table[1][(word >> 48) & 0xFF] ^ t.table[0][word >> 56];
+  }
+  for (; size > 0; size--, data++)
+    crc = (crc >> 8) ^ t.table[0][(crc ^ *data) & 0xFF];
+  return crc;
+}
+
+#if defined(__x86_64__)
+__attribute__((target("sse4.2"))) inline uint32_t crc32c_hardware(uint32_t crc, const uint8_t* data, size_t size) {
+  uint64_t crc64 = crc;
+  for (; size >= 8; size -= 8, data += 8) {
+    uint64_t word;
+    std::memcpy(&word, data, sizeof(word));
+    crc64 = _mm_crc32_u64(crc64, word);
+  }
+  crc = crc64;
+  for (; size > 0; size--, data++)
+    crc = _mm_crc32_u8(crc, *data);
+  return crc;
+}
+#endif
+
+/**
+ * computes the crc32c of the given bytes. Passing the result of a previous call as crc continues
+ * the checksum over concatenated buffers.
+ */
+inline uint32_t crc32c(const void* data, size_t size, uint32_t crc = 0) {
+#if defined(__x86_64__)
+  static const bool hardware = __builtin_cpu_supports("sse4.2");
+  if (hardware)
+    return ~crc32c_hardware(~crc, (const uint8_t*) data, size);
+#endif
+  return ~crc32c_software(~crc, (const uint8_t*) data, size);
+}
+
+#endif
@@ -5,8 +5,14 @@
 #include <random>
 #include <vector>
 
+#include "arena.h"
 #include "position.h"
 
+/**
+ * buffer of positions drawn from the buffer pool, whose new elements are left uninitialised on resize.
+ */
+using PositionBuffer = std::vector<Position, PoolAllocator<Position>>;
+
 struct Header {
   uint64_t position_count;
 
@@ -17,7 +23,7 @@ struct Header {
 
 struct DataSet {
   Header header {};
-  std::vector<Position> positions {};
+  PositionBuffer positions {};
 
   void shuffle() {
     std::shuffle(positions.begin(), positions.end(), std::mt19937(std::random_device()()));
@@ -0,0 +1,192 @@
+#ifndef DELTA_H
+#define DELTA_H
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include "bitboard.h"
+#include "mailbox.h"
+#include "packed.h"
+#include "piece.h"
+#include "position.h"
+
+/**
+ * game delta encoding of a sequence of positions. Selfplay data stores consecutive positions of the
+ * same game, which only differ in a few squares. Such positions are stored as the list of changed
+ * squares relative to the previous position, while the meta information is predicted from the
+ * previous position (side to move flips, move counters increment). Positions which do not continue
+ * the previous one, and the first position, are stored using the packed encoding.
+ *
+ * One flag byte is stored per position, followed by the streams of the delta positions and the
+ * packed full positions:
+ *
+ *    flags | score deltas (2 bytes each) | meta (variable) | changes (2 bytes each) | packed full positions
+ *
+ * All stream sizes follow from the flags, so no additional offsets need to be stored.
+ */
+#define DELTA_FULL        (0x80)
+#define DELTA_META        (0x40)
+#define DELTA_FIFTY_RESET (0x20)
+#define DELTA_WDL         (0x10)
+#define DELTA_MAX_CHANGES (8)
+
+/**
+ * meta information expected for the position following the given one within the same game.
+ */
+inline PositionMetaInformation predict_meta(const PositionMetaInformation& previous, bool fifty_reset) {
+  PositionMetaInformation meta = previous;
+  meta.set_active_player(!previous.get_active_player());
+  meta.set_en_passant_square(N_SQUARES);
+  meta.set_move_count(previous.get_move_count() + (previous.get_active_player() == BLACK));
+  meta.set_fifty_move_rule(fifty_reset ? 0 : previous.get_fifty_move_rule() + 1);
+  return meta;
+}
+
+inline bool same_meta(const PositionMetaInformation& a, const PositionMetaInformation& b) {
+  return a.m_move_count == b.m_move_count && a.m_fifty_move_rule == b.m_fifty_move_rule
+         && a.m_castling_and_active_player == b.m_castling_and_active_player
+         && a.m_en_passant_square == b.m_en_passant_square;
+}
+
+/**
+ * encodes the positions into the output buffer.
+ */
+inline void encode_delta(const Position* positions, size_t count, std::vector<uint8_t>& out) {
+  std::vector<uint8_t> flags(count);
+  std::vector<uint8_t> scores {};
+  std::vector<uint8_t> meta {};
+  std::vector<uint8_t> changes {};
+  std::vector<Position> full {};
+
+  Piece previous[N_SQUARES];
+  Piece current[N_SQUARES];
+
+  for (size_t i = 0; i < count; i++) {
+    const Position& p = positions[i];
+    to_mailbox(p, current);
+
+    // positions of another game differ in a lot of squares
+    int changed = DELTA_MAX_CHANGES + 1;
+    if (i > 0 && bit_count(p.m_occupancy ^ positions[i - 1].m_occupancy) <= DELTA_MAX_CHANGES) {
+      changed = 0;
+      for (Square sq = 0; sq < N_SQUARES; sq++)
+        changed += current[sq] != previous[sq];
+    }
+
+    if (i == 0 || changed > DELTA_MAX_CHANGES) {
+      flags[i] = DELTA_FULL;
+      full.push_back(p);
+    } else {
+      const Position& prev = positions[i - 1];
+      uint8_t flag         = changed;
+
+      if (same_meta(p.m_meta, predict_meta(prev.m_meta, true))) {
+        flag |= DELTA_FIFTY_RESET;
+      } else if (!same_meta(p.m_meta, predict_meta(prev.m_meta, false))) {
+        flag |= DELTA_META;
+        meta.insert(meta.end(), (const uint8_t*) &p.m_meta, (const uint8_t*) &p.m_meta + sizeof(p.m_meta));
+      }
+      if (p.m_result.wdl != prev.m_result.wdl) {
+        flag |= DELTA_WDL;
+        meta.push_back(p.m_result.wdl);
+      }
+
+      uint16_t score = (uint16_t) p.m_result.score - (uint16_t) prev.m_result.score;
+      scores.push_back(score & 0xFF);
+      scores.push_back(score >> 8);
+
+      for (Square sq = 0; sq < N_SQUARES; sq++) {
+        if (current[sq] != previous[sq]) {
+          changes.push_back(sq);
+          changes.push_back(current[sq]);
+        }
+      }
+      flags[i] = flag;
+    }
+    std::memcpy(previous, current, sizeof(previous));
+  }
+
+  std::vector<uint8_t> packed {};
+  encode_packed(full.data(), full.size(), packed);
+
+  out.clear();
+  out.reserve(flags.size() + scores.size() + meta.size() + changes.size() + packed.size());
+  for (const auto* stream : {&flags, &scores, &meta, &changes, &packed})
+    out.insert(out.end(), stream->begin(), stream->end());
+}
+
+/**
+ * decodes count positions from the buffer. The buffer must be readable for PACKED_PADDING bytes
+ * past its size.
+ * @return false if the size of the buffer does not match the encoded positions
+ */
+inline bool decode_delta(const uint8_t* in, size_t size, Position* positions, size_t count) {
+  if (size < count)
+    return false;
+
+  // compute the offsets of the streams from the flags
+  const uint8_t* flags = in;
+  size_t full_count    = 0;
+  size_t delta_count   = 0;
+  size_t meta_size     = 0;
+  size_t changes_count = 0;
+  for (size_t i = 0; i < count; i++) {
+    if (flags[i] & DELTA_FULL) {
+      full_count++;
+      continue;
+    }
+    delta_count++;
+    meta_size += (flags[i] & DELTA_META ? sizeof(PositionMetaInformation) : 0) + (flags[i] & DELTA_WDL ? 1 : 0);
+    changes_count += flags[i] & 0xF;
+  }
+
+  const uint8_t* scores  = flags + count;
+  const uint8_t* meta    = scores + 2 * delta_count;
+  const uint8_t* changes = meta + meta_size;
+  const uint8_t* packed  = changes + 2 * changes_count;
+  if (packed > in + size || (count > 0 && !(flags[0] & DELTA_FULL)))
+    return false;
+
+  std::vector<Position> full(full_count);
+  if (!decode_packed(packed, in + size - packed, full.data(), full_count))
+    return false;
+
+  Piece mailbox[N_SQUARES];
+  size_t next_full = 0;
+
+  for (size_t i = 0; i < count; i++) {
+    Position& p = positions[i];
+
+    if (flags[i] & DELTA_FULL) {
+      p = full[next_full++];
+      to_mailbox(p, mailbox);
+      continue;
+    }
+
+    const Position& prev = positions[i - 1];
+    p                    = Position {};
+
+    if (flags[i] & DELTA_META) {
+      std::memcpy(&p.m_meta, meta, sizeof(PositionMetaInformation));
+      meta += sizeof(PositionMetaInformation);
+    } else {
+      p.m_meta = predict_meta(prev.m_meta, flags[i] & DELTA_FIFTY_RESET);
+    }
+    p.m_result.wdl = flags[i] & DELTA_WDL ? (int8_t) *meta++ : prev.m_result.wdl;
+
+    uint16_t score   = (uint16_t) prev.m_result.score + (uint16_t) (scores[0] | scores[1] << 8);
+    p.m_result.score = (int16_t) score;
+    scores += 2;
+
+    for (int c = 0; c < (flags[i] & 0xF); c++, changes += 2) {
+      if (changes[0] >= N_SQUARES)
+        return false;
+      mailbox[changes[0]] = (Piece) changes[1];
+    }
+    from_mailbox(mailbox, p);
+  }
+  return true;
+}
+
+#endif
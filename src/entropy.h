@@ -0,0 +1,329 @@
+#ifndef ENTROPY_H
+#define ENTROPY_H
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include "bitboard.h"
+#include "mailbox.h"
+#include "material.h"
+#include "packed.h"
+#include "piece.h"
+#include "position.h"
+#include "square.h"
+
+/**
+ * entropy coding of positions using rANS with static models. The model stores the distribution of
+ * the piece count and, for each square and piece count bucket, the distribution over the 13 symbols
+ * (empty square + 12 pieces). It is trained once per file and stored within the file.
+ *
+ * Each position codes its piece count followed by the content of the squares in ascending order until
+ * all of its pieces are placed. Positions are distributed round robin onto ENTROPY_LANES independent
+ * rANS streams, which the decoder advances in lockstep so their dependency chains overlap. The meta
+ * information and results are stored in the packed format:
+ *
+ *    lane sizes (4 bytes each) | packed meta (PACKED_META_SIZE bytes each) | lane 0 | lane 1 | ...
+ *
+ * Blocks with positions the model cannot represent, i.e. more than MAX_PIECES_PER_BOARD pieces or
+ * piece types beyond the king, store the raw positions instead. Their lane sizes are all set to
+ * ENTROPY_RAW_BLOCK, which a coded block can never have.
+ */
+#define ENTROPY_SCALE_BITS    (12)
+#define ENTROPY_SCALE         (1 << ENTROPY_SCALE_BITS)
+#define ENTROPY_SYMBOLS       (13)
+#define ENTROPY_PIECE_BUCKETS (8)
+#define ENTROPY_LANES         (4)
+#define ENTROPY_RANS_LOWER    (1u << 23)
+#define ENTROPY_RAW_BLOCK     (UINT32_MAX)
+
+// upper bound of the encoded size of a single position, assuming each symbol costs the full 12 bits
+#define ENTROPY_MAX_SIZE(n) \
+  ((n) * (PACKED_META_SIZE + (N_SQUARES + 1) * ENTROPY_SCALE_BITS / 8 + 1) + ENTROPY_LANES * 8 + PACKED_PADDING)
+
+struct EntropyModel {
+  uint16_t piece_count[MAX_PIECES_PER_BOARD + 1];
+  uint16_t squares[ENTROPY_PIECE_BUCKETS][N_SQUARES][ENTROPY_SYMBOLS];
+};
+
+/**
+ * cumulative frequencies of the model which are used by the coder.
+ */
+struct EntropyTables {
+  uint16_t piece_count_start[MAX_PIECES_PER_BOARD + 2];
+  uint16_t squares_start[ENTROPY_PIECE_BUCKETS][N_SQUARES][ENTROPY_SYMBOLS + 1];
+
+  explicit EntropyTables(const EntropyModel& model) {
+    piece_count_start[0] = 0;
+    for (int s = 0; s <= MAX_PIECES_PER_BOARD; s++)
+      piece_count_start[s + 1] = piece_count_start[s] + model.piece_count[s];
+    for (int b = 0; b < ENTROPY_PIECE_BUCKETS; b++) {
+      for (int sq = 0; sq < N_SQUARES; sq++) {
+        squares_start[b][sq][0] = 0;
+        for (int s = 0; s < ENTROPY_SYMBOLS; s++)
+          squares_start[b][sq][s + 1] = squares_start[b][sq][s] + model.squares[b][sq][s];
+      }
+    }
+  }
+};
+
+/**
+ * maps pieces onto the symbols 1 to 12, 0 is used for empty squares.
+ */
+inline int entropy_symbol(Piece piece) {
+  return piece == NO_PIECE ? 0 : piece < 8 ? piece + 1 : piece - 1;
+}
+
+inline Piece entropy_piece(int symbol) {
+  return symbol == 0 ? (Piece) NO_PIECE : (Piece) (symbol <= 6 ? symbol - 1 : symbol + 1);
+}
+
+/**
+ * returns true if the pieces of the position can be coded without loss.
+ */
+inline bool is_entropy_codable(const Position& p) {
+  const int pieces = p.get_piece_count();
+  if (pieces > MAX_PIECES_PER_BOARD)
+    return false;
+  for (int i = 0; i < pieces; i++)
+    if (get_piece_type(p.m_pieces.get_piece(i)) > KING)
+      return false;
+  return true;
+}
+
+/**
+ * normalises the counts to frequencies summing up to ENTROPY_SCALE. Each symbol keeps a frequency
+ * of at least 1 so symbols which have not been seen during training can still be coded.
+ */
+inline void normalise_frequencies(const uint64_t* counts, uint16_t* frequencies, int symbols) {
+  uint64_t total = 0;
+  for (int s = 0; s < symbols; s++)
+    total += counts[s];
+
+  int sum     = 0;
+  int largest = 0;
+  for (int s = 0; s < symbols; s++) {
+    uint64_t scaled = total == 0 ? 0 : counts[s] * (ENTROPY_SCALE - symbols) / total;
+    frequencies[s]  = 1 + scaled;
+    sum += frequencies[s];
+    if (frequencies[s] > frequencies[largest])
+      largest = s;
+  }
+  frequencies[largest] += ENTROPY_SCALE - sum;
+}
+
+/**
+ * trains the model on the given positions.
+ */
+inline EntropyModel train_entropy_model(const Position* positions, size_t count) {
+  std::vector<uint64_t> piece_counts(MAX_PIECES_PER_BOARD + 1);
+  std::vector<uint64_t> squares(ENTROPY_PIECE_BUCKETS * N_SQUARES * ENTROPY_SYMBOLS);
+
+  for (size_t i = 0; i < count; i++) {
+    const Position& p = positions[i];
+    if (!is_entropy_codable(p))
+      continue;
+    const int pieces = p.get_piece_count();
+    const int bucket = piece_count_bucket(pieces, ENTROPY_PIECE_BUCKETS);
+    piece_counts[pieces]++;
+
+    Piece mailbox[N_SQUARES];
+    to_mailbox(p, mailbox);
+    for (Square sq = 0; sq < N_SQUARES; sq++)
+      squares[(bucket * N_SQUARES + sq) * ENTROPY_SYMBOLS + entropy_symbol(mailbox[sq])]++;
+  }
+
+  EntropyModel model {};
+  normalise_frequencies(piece_counts.data(), model.piece_count, MAX_PIECES_PER_BOARD + 1);
+  for (int b = 0; b < ENTROPY_PIECE_BUCKETS; b++)
+    for (int sq = 0; sq < N_SQUARES; sq++)
+      normalise_frequencies(&squares[(b * N_SQUARES + sq) * ENTROPY_SYMBOLS], model.squares[b][sq], ENTROPY_SYMBOLS);
+  return model;
+}
+
+/**
+ * rANS encoder which collects the symbols of a lane and writes them in reverse order.
+ */
+struct RansEncoder {
+  std::vector<uint32_t> symbols {};
+
+  void put(uint16_t start, uint16_t frequency) {
+    symbols.push_back((uint32_t) start << 16 | frequency);
+  }
+
+  void finish(std::vector<uint8_t>& out) {
+    std::vector<uint8_t> reversed {};
+    uint32_t x = ENTROPY_RANS_LOWER;
+    for (auto it = symbols.rbegin(); it != symbols.rend(); it++) {
+      uint32_t start     = *it >> 16;
+      uint32_t frequency = *it & 0xFFFF;
+      uint32_t x_max     = ((ENTROPY_RANS_LOWER >> ENTROPY_SCALE_BITS) << 8) * frequency;
+      while (x >= x_max) {
+        reversed.push_back(x & 0xFF);
+        x >>= 8;
+      }
+      x = ((x / frequency) << ENTROPY_SCALE_BITS) + (x % frequency) + start;
+    }
+    for (int i = 0; i < 4; i++, x >>= 8)
+      reversed.push_back(x & 0xFF);
+    out.insert(out.end(), reversed.rbegin(), reversed.rend());
+  }
+};
+
+/**
+ * rANS decoder reading a lane front to back.
+ */
+struct RansDecoder {
+  uint32_t x = 0;
+  const uint8_t* data;
+  const uint8_t* end;
+
+  RansDecoder(const uint8_t* p_data, const uint8_t* p_end) : data(p_data), end(p_end) {
+    for (int i = 0; i < 4 && data < end; i++)
+      x = x << 8 | *data++;
+  }
+
+  /**
+   * decodes the next symbol given the cumulative frequencies of its context.
+   */
+  int get(const uint16_t* start, int symbols) {
+    uint32_t slot = x & (ENTROPY_SCALE - 1);
+    int s         = 0;
+    while (s + 1 < symbols && start[s + 1] <= slot)
+      s++;
+    x = (start[s + 1] - start[s]) * (x >> ENTROPY_SCALE_BITS) + slot - start[s];
+    while (x < ENTROPY_RANS_LOWER && data < end)
+      x = x << 8 | *data++;
+    return s;
+  }
+};
+
+/**
+ * encodes the positions into the output buffer using the given model.
+ * @return false without encoding anything if a position cannot be coded without loss
+ */
+inline bool encode_entropy(const Position* positions,
+                           size_t count,
+                           const EntropyTables& tables,
+                           std::vector<uint8_t>& out) {
+  for (size_t i = 0; i < count; i++)
+    if (!is_entropy_codable(positions[i]))
+      return false;
+
+  RansEncoder lanes[ENTROPY_LANES];
+  std::vector<uint8_t> meta(count * PACKED_META_SIZE);
+
+  for (size_t i = 0; i < count; i++) {
+    const Position& p = positions[i];
+    RansEncoder& lane = lanes[i % ENTROPY_LANES];
+    const int pieces  = p.get_piece_count();
+    const auto& start = tables.squares_start[piece_count_bucket(pieces, ENTROPY_PIECE_BUCKETS)];
+
+    pack_meta(p, &meta[i * PACKED_META_SIZE]);
+    lane.put(tables.piece_count_start[pieces], tables.piece_count_start[pieces + 1] - tables.piece_count_start[pieces]);
+
+    Piece mailbox[N_SQUARES];
+    to_mailbox(p, mailbox);
+    int placed = 0;
+    for (Square sq = 0; sq < N_SQUARES && placed < pieces; sq++) {
+      placed += mailbox[sq] != NO_PIECE;
+      int s = entropy_symbol(mailbox[sq]);
+      lane.put(start[sq][s], start[sq][s + 1] - start[sq][s]);
+    }
+  }
+
+  std::vector<uint8_t> encoded[ENTROPY_LANES];
+  for (int l = 0; l < ENTROPY_LANES; l++)
+    lanes[l].finish(encoded[l]);
+
+  out.clear();
+  for (int l = 0; l < ENTROPY_LANES; l++) {
+    uint32_t size = encoded[l].size();
+    out.insert(out.end(), (uint8_t*) &size, (uint8_t*) &size + sizeof(size));
+  }
+  out.insert(out.end(), meta.begin(), meta.end());
+  for (int l = 0; l < ENTROPY_LANES; l++)
+    out.insert(out.end(), encoded[l].begin(), encoded[l].end());
+  return true;
+}
+
+/**
+ * stores the positions unencoded, for blocks which encode_entropy cannot code.
+ */
+inline void encode_entropy_raw(const Position* positions, size_t count, std::vector<uint8_t>& out) {
+  uint32_t lane_sizes[ENTROPY_LANES];
+  std::fill(lane_sizes, lane_sizes + ENTROPY_LANES, ENTROPY_RAW_BLOCK);
+  out.assign((const uint8_t*) lane_sizes, (const uint8_t*) lane_sizes + sizeof(lane_sizes));
+  out.insert(out.end(), (const uint8_t*) positions, (const uint8_t*) (positions + count));
+}
+
+/**
+ * decodes count positions from the buffer using the given model.
+ * @return false if the size of the buffer does not match the encoded positions
+ */
+inline bool decode_entropy(const uint8_t* in,
+                           size_t size,
+                           const EntropyTables& tables,
+                           Position* positions,
+                           size_t count) {
+  uint32_t lane_sizes[ENTROPY_LANES];
+  if (size < sizeof(lane_sizes) + count * PACKED_META_SIZE)
+    return false;
+  std::memcpy(lane_sizes, in, sizeof(lane_sizes));
+
+  if (std::all_of(lane_sizes, lane_sizes + ENTROPY_LANES, [](uint32_t s) { return s == ENTROPY_RAW_BLOCK; })) {
+    if (size != sizeof(lane_sizes) + count * sizeof(Position))
+      return false;
+    std::memcpy((void*) positions, in + sizeof(lane_sizes), count * sizeof(Position));
+    return true;
+  }
+
+  const uint8_t* meta = in + sizeof(lane_sizes);
+  const uint8_t* data = meta + count * PACKED_META_SIZE;
+  const uint8_t* end  = in + size;
+
+  std::vector<RansDecoder> lanes {};
+  for (int l = 0; l < ENTROPY_LANES; l++) {
+    if (data + lane_sizes[l] > end)
+      return false;
+    lanes.emplace_back(data, data + lane_sizes[l]);
+    data += lane_sizes[l];
+  }
+  if (data != end)
+    return false;
+
+  // decode one position per lane at a time so the lanes are advanced in lockstep
+  for (size_t first = 0; first < count; first += ENTROPY_LANES) {
+    const int active = std::min<size_t>(ENTROPY_LANES, count - first);
+    int pieces[ENTROPY_LANES] {};
+    int placed[ENTROPY_LANES] {};
+    BB bitboards[ENTROPY_LANES][16] {};
+
+    for (int l = 0; l < active; l++) {
+      Position& p = positions[first + l];
+      p           = Position {};
+      unpack_meta(&meta[(first + l) * PACKED_META_SIZE], p);
+      pieces[l] = lanes[l].get(tables.piece_count_start, MAX_PIECES_PER_BOARD + 1);
+    }
+
+    for (Square sq = 0; sq < N_SQUARES; sq++) {
+      for (int l = 0; l < active; l++) {
+        if (placed[l] >= pieces[l])
+          continue;
+        const auto& start = tables.squares_start[piece_count_bucket(pieces[l], ENTROPY_PIECE_BUCKETS)][sq];
+        Piece piece       = entropy_piece(lanes[l].get(start, ENTROPY_SYMBOLS));
+        if (piece == NO_PIECE)
+          continue;
+
+        set_bit(bitboards[l][piece], sq);
+        placed[l]++;
+      }
+    }
+    for (int l = 0; l < active; l++)
+      from_piece_bitboards(bitboards[l], positions[first + l]);
+  }
+  return true;
+}
+
+#endif
@@ -3,15 +3,22 @@
 
 #include <cmath>
 #include <cstring>
+#include <fstream>
+#include <iostream>
 #include <sstream>
 #include <string>
+#include <vector>
 
 #include "bitboard.h"
 #include "defs.h"
+#include "mailbox.h"
 #include "piece.h"
 #include "position.h"
+#include "progress.h"
 #include "square.h"
 
+#define FEN_BATCH_SIZE (1 << 16)
+
 struct FenCharacter {
   char character {0};
   Square skip_squares {0};
@@ -62,7 +69,9 @@ inline void init_character_lookup() {
 }
 
 inline Position parse_fen(const std::string& fen) {
-  init_character_lookup();
+  // initialised exactly once, even when parsing from multiple threads
+  static const bool initialised = (init_character_lookup(), true);
+  (void) initialised;
 
   // track which char of the fen we parse
   int character_index = 0;
@@ -74,24 +83,16 @@ inline Position parse_fen(const std::string& fen) {
   // read pieces first
   // -----------------------------------------------------------------------------------------------
   Square square = A8;
-  Piece pieces[64] {};
-  std::memset(pieces, (Piece) NO_PIECE, sizeof(Piece) * 64);
+  BB bitboards[16] {};
   for (; character_index < fen.size() && fen[character_index] != ' '; character_index++) {
     FenCharacter& ch = fen_character_lookup[fen[character_index]];
     if (ch.piece != NO_PIECE) {
-      pieces[square] = ch.piece;
+      set_bit(bitboards[ch.piece], square);
     }
     square += ch.skip_squares;
   }
   // translate pieces to position format
-  for (Square i = 0; i < 64; i++) {
-    if (pieces[i] != NO_PIECE) {
-      // add the corresponding piece to the given square
-      int existing_pieces = position.get_piece_count();
-      set_bit(position.m_occupancy, i);
-      position.m_pieces.set_piece(existing_pieces, pieces[i]);
-    }
-  }
+  from_piece_bitboards(bitboards, position);
 
   character_index++;
 
@@ -175,6 +176,9 @@ inline Position parse_fen(const std::string& fen) {
 inline std::string write_fen(const Position& position, bool write_score = false) {
   std::stringstream ss;
 
+  Piece mailbox[N_SQUARES];
+  to_mailbox(position, mailbox);
+
   // we do it in the same way we read a fen.
   // first, we write the pieces
   for (Rank n = 7; n >= 0; n--) {
@@ -182,7 +186,7 @@ inline std::string write_fen(const Position& position, bool write_score = false)
     for (File i = 0; i < 8; i++) {
       Square s = sq_idx(n, i);
 
-      int piece = position.get_piece(s);
+      int piece = mailbox[s];
       if (piece == -1) {
         counting++;
       } else {
@@ -249,4 +253,55 @@ inline std::string write_fen(const Position& position, bool write_score = false)
   return ss.str();
 }
 
+/**
+ * parses each line into a position.
+ */
+inline void parse_fens(const std::vector<std::string>& fens, std::vector<Position>& positions) {
+  positions.resize(fens.size());
+  for (size_t i = 0; i < fens.size(); i++)
+    positions[i] = parse_fen(fens[i]);
+}
+
+/**
+ * reads the lines of the given fen files in batches of up to FEN_BATCH_SIZE lines, one file after
+ * the other. Files which cannot be opened are skipped.
+ */
+struct FenSource {
+  std::vector<std::string> files;
+  size_t next_file = 0;
+  std::ifstream in {};
+  StageCounters& stage;
+
+  explicit FenSource(const std::vector<std::string>& p_files) : files(p_files), stage(progress_stage("read")) {}
+
+  /**
+   * reads the next batch of lines into the given buffer.
+   * @return false once all files are exhausted
+   */
+  bool next(std::vector<std::string>& fens) {
+    fens.clear();
+    uint64_t bytes = 0;
+    while (true) {
+      for (std::string fen; fens.size() < FEN_BATCH_SIZE && std::getline(in, fen);) {
+        bytes += fen.size() + 1;
+        fens.push_back(std::move(fen));
+      }
+      if (!fens.empty()) {
+        stage.add(fens.size(), bytes);
+        return true;
+      }
+
+      if (next_file == files.size())
+        return false;
+      const std::string& file = files[next_file++];
+      in                      = std::ifstream {file};
+      if (!in.is_open()) {
+        std::cout << "could not open: " << file << std::endl;
+        continue;
+      }
+      std::cout << "Reading from " << file << std::endl;
+    }
+  }
+};
+
 #endif
@@ -0,0 +1,177 @@
+#ifndef FILTER_H
+#define FILTER_H
+
+#include <atomic>
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "blockstats.h"
+#include "pipeline.h"
+#include "position.h"
+#include "reader.h"
+#include "threads.h"
+
+/**
+ * blocks of a file which were skipped using their stats, and blocks which were answered from the
+ * stats alone. Failed is set if a file could not be opened or read completely.
+ */
+struct FilterSummary {
+  uint64_t blocks  = 0;
+  uint64_t skipped = 0;
+  uint64_t trusted = 0;
+  bool failed      = false;
+
+  void print() const {
+    if (blocks > 0)
+      std::cout << "Skipped " << skipped << " and answered " << trusted << " of " << blocks
+                << " block(s) from the block stats" << std::endl;
+  }
+};
+
+/**
+ * reads the given blocks in parallel and calls func(positions) with the matching positions of each
+ * batch of blocks. Decoding already spreads each batch of blocks across the threads, so the blocks do
+ * not go through a pipeline.
+ * @return false if a block could not be read
+ */
+template<typename F>
+inline bool stream_filtered_blocks(BlockReader& reader,
+                                   const std::vector<size_t>& blocks,
+                                   const PositionFilter& filter,
+                                   F&& func) {
+  std::vector<std::vector<Position>> matching(thread_count());
+  std::vector<Position> positions {};
+  std::atomic<bool> success {true};
+
+  for (size_t first = 0; first < blocks.size(); first += thread_count()) {
+    const size_t batch = std::min<size_t>(thread_count(), blocks.size() - first);
+
+    parallel_for(batch, [&](size_t begin, size_t end, int) {
+      std::vector<Position> block {};
+      for (size_t b = begin; b < end; b++) {
+        matching[b].clear();
+        if (!reader.read_block(blocks[first + b], block)) {
+          std::cout << "corrupted block " << blocks[first + b] << std::endl;
+          success = false;
+          continue;
+        }
+        for (const Position& p : block)
+          if (filter.matches(p))
+            matching[b].push_back(p);
+      }
+    });
+
+    positions.clear();
+    for (size_t b = 0; b < batch; b++)
+      positions.insert(positions.end(), matching[b].begin(), matching[b].end());
+    if (!positions.empty())
+      func(positions);
+  }
+  return success;
+}
+
+/**
+ * streams all positions of the given files which match the filter and calls func(positions) for
+ * each chunk. Blocks of block compressed files whose stats cannot match the filter are never read.
+ * If trusted is set, func_stats(stats) is called instead for blocks whose positions all match,
+ * without reading them.
+ * @return the amount of blocks skipped and answered from the stats, and whether reading failed
+ */
+template<typename F, typename G>
+inline FilterSummary stream_filtered(const std::vector<std::string>& files,
+                                     const PositionFilter& filter,
+                                     F&& func,
+                                     G&& func_stats,
+                                     bool trusted     = false,
+                                     uint32_t columns = COLUMN_ALL) {
+  FilterSummary summary {};
+
+  // the workers filter the chunks of raw files, the sink receives them in the order of the file
+  struct FilterBatch {
+    std::vector<Position> positions {};
+    std::vector<Position> matching {};
+  };
+
+  for (const auto& file : files) {
+    FinReader reader {file, columns};
+    if (!reader.is_open()) {
+      std::cout << "could not open: " << file << std::endl;
+      summary.failed = true;
+      continue;
+    }
+    std::cout << "Reading from " << file << " with " << reader.header.position_count << " position(s)" << std::endl;
+
+    if (reader.block != nullptr && reader.block->has_stats()) {
+      BlockReader& block = *reader.block;
+      std::vector<size_t> candidates {};
+      for (size_t b = 0; b < block.block_count(); b++) {
+        summary.blocks++;
+        if (!filter.may_match(block.stats[b])) {
+          summary.skipped++;
+        } else if (trusted && filter.matches_all(block.stats[b])) {
+          summary.trusted++;
+          func_stats(block.stats[b]);
+        } else {
+          candidates.push_back(b);
+        }
+      }
+      if (!stream_filtered_blocks(block, candidates, filter, func))
+        summary.failed = true;
+      continue;
+    }
+
+    // the reader stops at the first chunk it cannot read, so a short count means the file failed
+    uint64_t read = 0;
+    bool success  = run_pipeline<FilterBatch>(
+      "filter",
+      [&](FilterBatch& batch) {
+        read += reader.read(batch.positions, 1 << 20);
+        return !batch.positions.empty();
+      },
+      [&](FilterBatch& batch) {
+        batch.matching.clear();
+        for (const Position& p : batch.positions)
+          if (filter.matches(p))
+            batch.matching.push_back(p);
+      },
+      [&](FilterBatch& batch) {
+        if (!batch.matching.empty())
+          func(batch.matching);
+        return true;
+      },
+      true);
+    if (!success || read != reader.header.position_count)
+      summary.failed = true;
+  }
+  return summary;
+}
+
+/**
+ * summarises all positions of the given files which match the filter. Blocks which only contain
+ * matching positions are answered from their stats.
+ * @return false if a file could not be opened or read completely
+ */
+inline bool filtered_stats(const std::vector<std::string>& files, const PositionFilter& filter, DatasetStats& total) {
+  std::vector<DatasetStats> local(thread_count());
+
+  FilterSummary summary = stream_filtered(
+    files,
+    filter,
+    [&](const std::vector<Position>& positions) {
+      parallel_for(positions.size(), [&](size_t begin, size_t end, int t) {
+        local[t].merge(compute_block_stats(&positions[begin], end - begin));
+      });
+    },
+    [&](const BlockStats& stats) { total.merge(stats); },
+    true,
+    COLUMN_OCCUPANCY | COLUMN_META | COLUMN_RESULT);
+
+  for (const DatasetStats& l : local)
+    total.merge(l);
+  summary.print();
+  return !summary.failed;
+}
+
+#endif
@@ -0,0 +1,39 @@
+#ifndef HASH_H
+#define HASH_H
+
+#include <algorithm>
+
+#include "defs.h"
+#include "position.h"
+
+/**
+ * finaliser of splitmix64 which maps each input bit onto all output bits.
+ */
+inline Key mix_hash(Key key) {
+  key = (key ^ (key >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  key = (key ^ (key >> 27)) * 0x94d049bb133111ebULL;
+  return key ^ (key >> 31);
+}
+
+/**
+ * hashes the board state of the position, that is the pieces, the side to move, the castling rights
+ * and the en passant square. The move counters and the result are ignored, so the same position
+ * reached in different games always produces the same hash.
+ */
+inline Key position_hash(const Position& position, Key seed = 0) {
+  Key key          = mix_hash(seed ^ position.m_occupancy);
+  const int pieces = position.get_piece_count();
+
+  for (int b = 0; b < MAX_BUCKETS; b++) {
+    // ignore the unused nibbles after the last piece
+    int used = std::min(std::max(pieces - b * PIECES_PER_BUCKET, 0), PIECES_PER_BUCKET);
+    BB bucket = used == PIECES_PER_BUCKET ? position.m_pieces.m_piece_buckets[b]
+                                          : position.m_pieces.m_piece_buckets[b] & ((1ULL << (4 * used)) - 1);
+    key       = mix_hash(key ^ bucket);
+  }
+
+  Key meta = position.m_meta.m_castling_and_active_player | ((Key) (uint8_t) position.m_meta.m_en_passant_square << 8);
+  return mix_hash(key ^ meta);
+}
+
+#endif
@@ -0,0 +1,353 @@
+#include "libfin.h"
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <numeric>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "augment.h"
+#include "nnue_features.h"
+#include "hash.h"
+#include "manifest.h"
+#include "planes.h"
+#include "position.h"
+
+static_assert(sizeof(Position) == FIN_POSITION_SIZE, "the records of the interface must match the positions");
+static_assert(sizeof(fin_feature_set::king_buckets) == sizeof(FeatureSet::king_buckets), "king buckets must match");
+
+namespace {
+
+thread_local std::string last_error {};
+
+/**
+ * a submitted buffer and the index of the batch it receives.
+ */
+struct Batch {
+  Position* buffer;
+  uint64_t index;
+  size_t count = 0;
+  bool done    = false;
+  bool failed  = false;
+};
+
+FeatureSet to_feature_set(const fin_feature_set& set) {
+  FeatureSet res {};
+  std::copy(std::begin(set.king_buckets), std::end(set.king_buckets), res.king_buckets);
+  res.bucket_count = set.bucket_count;
+  res.mirrored     = set.mirrored != 0;
+  return res;
+}
+
+/**
+ * runs the body of an entry point and returns the given error value if it throws, since exceptions
+ * must not cross the C interface.
+ */
+template<typename T, typename F>
+T guarded(T error, F body) {
+  try {
+    return body();
+  } catch (const std::exception& e) {
+    last_error = e.what();
+  } catch (...) {
+    last_error = "unknown error";
+  }
+  return error;
+}
+
+}    // namespace
+
+/**
+ * the dataset is cut into pieces of contiguous positions. Each epoch visits all pieces in the order
+ * of its permutation, and each batch consists of the next pieces_per_batch pieces of that order.
+ */
+struct fin_loader {
+  Manifest manifest;
+  fin_loader_options options;
+  uint64_t piece_size;
+  uint64_t piece_count;
+
+  std::mutex mutex {};
+  std::condition_variable work {};
+  std::condition_variable finished {};
+  // batches in submission order and batches waiting for a worker
+  std::deque<std::shared_ptr<Batch>> pending {};
+  std::deque<std::shared_ptr<Batch>> queue {};
+  uint64_t next_batch = 0;
+  bool stop           = false;
+  std::vector<std::thread> workers {};
+
+  // piece orders of the epochs which are currently read
+  std::map<uint64_t, std::shared_ptr<const std::vector<uint64_t>>> orders {};
+
+  fin_loader(const Manifest& p_manifest, const fin_loader_options& p_options) :
+      manifest(p_manifest), options(p_options) {
+    piece_size  = std::max<uint64_t>(1, (options.batch_size + options.pieces_per_batch - 1) / options.pieces_per_batch);
+    piece_count = (manifest.size() + piece_size - 1) / piece_size;
+    try {
+      for (uint32_t t = 0; t < options.threads; t++)
+        workers.emplace_back([this]() { run(); });
+    } catch (...) {
+      // the destructor does not run for a partially constructed loader
+      shutdown();
+      throw;
+    }
+  }
+
+  ~fin_loader() {
+    shutdown();
+  }
+
+  /**
+   * stops and joins the workers.
+   */
+  void shutdown() {
+    {
+      std::lock_guard<std::mutex> lock {mutex};
+      stop = true;
+    }
+    work.notify_all();
+    for (auto& worker : workers)
+      worker.join();
+  }
+
+  /**
+   * returns the piece order of the given epoch, computing it on first use. Orders of epochs which
+   * are no longer read are dropped.
+   */
+  std::shared_ptr<const std::vector<uint64_t>> order(uint64_t epoch) {
+    std::lock_guard<std::mutex> lock {mutex};
+    auto it = orders.find(epoch);
+    if (it != orders.end())
+      return it->second;
+
+    auto pieces = std::make_shared<std::vector<uint64_t>>(piece_count);
+    std::iota(pieces->begin(), pieces->end(), 0);
+    if (options.shuffle) {
+      std::mt19937_64 gen(mix_hash(options.seed ^ mix_hash(epoch)));
+      std::shuffle(pieces->begin(), pieces->end(), gen);
+    }
+    while (orders.size() > 2)
+      orders.erase(orders.begin());
+    orders[epoch] = pieces;
+    return pieces;
+  }
+
+  bool fill(ManifestReader& reader, Batch& batch) {
+    batch.count = 0;
+    for (uint64_t s = 0; s < options.pieces_per_batch && batch.count < options.batch_size; s++) {
+      uint64_t slot  = batch.index * options.pieces_per_batch + s;
+      uint64_t piece = (*order(slot / piece_count))[slot % piece_count];
+      uint64_t first = piece * piece_size;
+      uint64_t count = std::min({piece_size, manifest.size() - first, (uint64_t) options.batch_size - batch.count});
+
+      // raw files are read straight into the buffer of the caller
+      if (!reader.read_at(first, count, batch.buffer + batch.count))
+        return false;
+      batch.count += count;
+    }
+
+    augment_random(batch.buffer, batch.count, options.augment, mix_hash(options.seed ^ mix_hash(batch.index + 1)));
+    if (options.shuffle) {
+      std::mt19937_64 gen(mix_hash(options.seed ^ mix_hash(~batch.index)));
+      std::shuffle(batch.buffer, batch.buffer + batch.count, gen);
+    }
+    return true;
+  }
+
+  void run() {
+    ManifestReader reader {manifest};
+    while (true) {
+      std::shared_ptr<Batch> batch {};
+      {
+        std::unique_lock<std::mutex> lock {mutex};
+        work.wait(lock, [&]() { return stop || !queue.empty(); });
+        if (stop)
+          return;
+        batch = queue.front();
+        queue.pop_front();
+      }
+
+      bool success = fill(reader, *batch);
+      {
+        std::lock_guard<std::mutex> lock {mutex};
+        batch->done   = true;
+        batch->failed = !success;
+      }
+      finished.notify_all();
+    }
+  }
+};
+
+int fin_abi_version(void) {
+  return FIN_ABI_VERSION;
+}
+
+const char* fin_last_error(void) {
+  return last_error.c_str();
+}
+
+fin_loader_options fin_loader_default_options(void) {
+  fin_loader_options options {};
+  options.batch_size       = 16384;
+  options.pieces_per_batch = 16;
+  options.threads          = 4;
+  options.shuffle          = 1;
+  options.seed             = 0;
+  options.augment          = 0;
+  return options;
+}
+
+fin_loader* fin_loader_open(const char* const* files, size_t file_count, const fin_loader_options* options) {
+  last_error.clear();
+  return guarded<fin_loader*>(nullptr, [&]() -> fin_loader* {
+    fin_loader_options o = options != nullptr ? *options : fin_loader_default_options();
+    if (o.batch_size == 0 || o.threads == 0 || o.pieces_per_batch == 0 || o.pieces_per_batch > o.batch_size) {
+      last_error = "invalid options";
+      return nullptr;
+    }
+
+    std::vector<std::string> names(files, files + file_count);
+    Manifest manifest {};
+    std::string failed {};
+    if (!Manifest::from_files(names, manifest, &failed)) {
+      last_error = "could not load: " + failed;
+      return nullptr;
+    }
+    if (manifest.size() == 0) {
+      last_error = "the files contain no positions";
+      return nullptr;
+    }
+    return new fin_loader(manifest, o);
+  });
+}
+
+uint64_t fin_loader_size(const fin_loader* loader) {
+  return loader->manifest.size();
+}
+
+int fin_loader_submit(fin_loader* loader, void* buffer) {
+  return guarded(-1, [&]() {
+    if (buffer == nullptr) {
+      last_error = "buffer is null";
+      return -1;
+    }
+    auto batch = std::make_shared<Batch>(Batch {(Position*) buffer, 0});
+    {
+      std::lock_guard<std::mutex> lock {loader->mutex};
+      batch->index = loader->next_batch++;
+      loader->pending.push_back(batch);
+      loader->queue.push_back(batch);
+    }
+    loader->work.notify_one();
+    return 0;
+  });
+}
+
+void* fin_loader_wait(fin_loader* loader, size_t* count) {
+  return guarded<void*>(nullptr, [&]() -> void* {
+    std::shared_ptr<Batch> batch {};
+    {
+      std::unique_lock<std::mutex> lock {loader->mutex};
+      if (loader->pending.empty()) {
+        last_error = "no buffer has been submitted";
+        return nullptr;
+      }
+      batch = loader->pending.front();
+      loader->pending.pop_front();
+      loader->finished.wait(lock, [&]() { return batch->done; });
+    }
+
+    if (batch->failed) {
+      last_error = "could not read batch " + std::to_string(batch->index);
+      return nullptr;
+    }
+    if (count != nullptr)
+      *count = batch->count;
+    return batch->buffer;
+  });
+}
+
+void fin_loader_close(fin_loader* loader) {
+  delete loader;
+}
+
+void fin_augment(void* positions, size_t count, uint32_t transforms) {
+  Position* p = (Position*) positions;
+  for (size_t i = 0; i < count; i++)
+    augment(p[i], transforms);
+}
+
+int fin_feature_set_named(const char* name, fin_feature_set* set) {
+  return guarded(-1, [&]() {
+    FeatureSet res {};
+    if (!res.parse(name)) {
+      last_error = "unknown feature set: " + std::string(name);
+      return -1;
+    }
+    std::copy(std::begin(res.king_buckets), std::end(res.king_buckets), set->king_buckets);
+    set->bucket_count = res.bucket_count;
+    set->mirrored     = res.mirrored;
+    return 0;
+  });
+}
+
+uint32_t fin_feature_set_size(const fin_feature_set* set) {
+  return to_feature_set(*set).input_size();
+}
+
+int64_t fin_extract_features(const void* positions,
+                             size_t count,
+                             const fin_feature_set* set,
+                             uint32_t threads,
+                             uint64_t* offsets,
+                             int32_t* stm,
+                             int32_t* nstm) {
+  return guarded<int64_t>(-1, [&]() -> int64_t {
+    FeatureSet features = to_feature_set(*set);
+    if (!features.is_valid()) {
+      last_error = "invalid feature set";
+      return -1;
+    }
+    const int workers = std::max<uint32_t>(1, threads);
+    if (!extract_features((const Position*) positions, count, features, offsets, stm, nstm, workers)) {
+      last_error = "position with more than " + std::to_string(MAX_PIECES_PER_BOARD) + " pieces";
+      return -1;
+    }
+    return offsets[count];
+  });
+}
+
+void fin_features_to_rows(const uint64_t* offsets, size_t count, uint32_t* rows) {
+  for (size_t i = 0; i < count; i++)
+    std::fill(rows + offsets[i], rows + offsets[i + 1], (uint32_t) i);
+}
+
+int fin_expand_planes(const void* positions,
+                      size_t count,
+                      int type,
+                      uint32_t threads,
+                      void* planes,
+                      int16_t* score,
+                      int8_t* wdl) {
+  return guarded(-1, [&]() {
+    if (type != FIN_PLANES_U8 && type != FIN_PLANES_F32) {
+      last_error = "invalid plane type";
+      return -1;
+    }
+    const int workers = std::max<uint32_t>(1, threads);
+    if (type == FIN_PLANES_U8)
+      expand_planes((const Position*) positions, count, (uint8_t*) planes, workers);
+    else
+      expand_planes((const Position*) positions, count, (float*) planes, workers);
+    extract_targets((const Position*) positions, count, score, wdl);
+    return 0;
+  });
+}
@@ -0,0 +1,169 @@
+#ifndef LIBFIN_H
+#define LIBFIN_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * C interface of libfin for loading fin files into training code.
+ *
+ * Positions are returned as raw 32 byte records in the layout of the fin files:
+ *
+ *    piece nibbles (16 bytes) | occupancy (8 bytes) | meta (4 bytes) | score (2 bytes) | wdl (1 byte) | padding
+ *
+ * The loader streams batches of positions into buffers owned by the caller. Buffers are submitted
+ * ahead of time and filled by background threads, so up to the amount of submitted buffers is
+ * prefetched. Batches are returned in the order their buffers were submitted, and the content of
+ * each batch only depends on the seed and its index, not on the amount of threads.
+ */
+#define FIN_POSITION_SIZE  (32)
+#define FIN_ABI_VERSION    (2)
+#define FIN_PLANES_U8      (0)
+#define FIN_PLANES_F32     (1)
+#define FIN_AUGMENT_MIRROR (1)
+#define FIN_AUGMENT_FLIP   (2)
+#define FIN_API            __attribute__((visibility("default")))
+
+typedef struct fin_loader fin_loader;
+
+typedef struct fin_loader_options {
+  // amount of positions per batch
+  uint32_t batch_size;
+  // amount of contiguous pieces each batch is assembled from when shuffling
+  uint32_t pieces_per_batch;
+  // amount of background threads filling buffers
+  uint32_t threads;
+  // shuffle the order of the pieces and the positions within each batch
+  int shuffle;
+  uint64_t seed;
+  // combination of FIN_AUGMENT_MIRROR and FIN_AUGMENT_FLIP, a random subset of which is applied to
+  // each position
+  uint32_t augment;
+} fin_loader_options;
+
+/**
+ * configuration of sparse nnue input features. Each piece activates the feature
+ * king_buckets[king square] * 768 + (own piece ? 0 : 6) * 64 + piece type * 64 + square, with the
+ * squares seen from the perspective and mirrored horizontally so the king stands on the files e to
+ * h if mirrored is set.
+ */
+typedef struct fin_feature_set {
+  uint8_t king_buckets[64];
+  uint32_t bucket_count;
+  int mirrored;
+} fin_feature_set;
+
+/**
+ * version of the interface, changes whenever the interface changes incompatibly.
+ */
+FIN_API int fin_abi_version(void);
+
+/**
+ * message describing the last error of the calling thread, or an empty string. No function of the
+ * interface throws, internal exceptions such as failed allocations are reported as errors here.
+ */
+FIN_API const char* fin_last_error(void);
+
+/**
+ * default options: batches of 16384 positions from 16 pieces, shuffled, using 4 threads, without
+ * augmentation.
+ */
+FIN_API fin_loader_options fin_loader_default_options(void);
+
+/**
+ * opens a loader over the concatenation of the given fin, .finz or manifest files. The batches
+ * cycle through the dataset endlessly, reshuffling the pieces for each epoch.
+ * @return NULL on failure, see fin_last_error
+ */
+FIN_API fin_loader* fin_loader_open(const char* const* files, size_t file_count, const fin_loader_options* options);
+
+/**
+ * total amount of positions of the dataset.
+ */
+FIN_API uint64_t fin_loader_size(const fin_loader* loader);
+
+/**
+ * submits a buffer with room for batch_size positions to be filled with the next batch. The buffer
+ * must stay valid until it is returned by fin_loader_wait.
+ * @return 0 on success
+ */
+FIN_API int fin_loader_submit(fin_loader* loader, void* buffer);
+
+/**
+ * waits for the oldest submitted buffer to be filled.
+ * @param count  receives the amount of positions written into the buffer
+ * @return the buffer, or NULL if no buffer is pending or reading failed, see fin_last_error
+ */
+FIN_API void* fin_loader_wait(fin_loader* loader, size_t* count);
+
+/**
+ * stops the background threads and closes all files. Pending buffers are not filled.
+ */
+FIN_API void fin_loader_close(fin_loader* loader);
+
+/**
+ * applies the given combination of FIN_AUGMENT_MIRROR and FIN_AUGMENT_FLIP to all positions in
+ * place. Mirroring swaps the files a and h and drops the castling rights, flipping swaps the colors
+ * and the ranks and negates the score and the result.
+ */
+FIN_API void fin_augment(void* positions, size_t count, uint32_t transforms);
+
+/**
+ * fills the feature set with one of '768', '768-mirrored', 'halfka' or 'halfka-mirrored'.
+ * @return 0 on success
+ */
+FIN_API int fin_feature_set_named(const char* name, fin_feature_set* set);
+
+/**
+ * amount of input features of the feature set.
+ */
+FIN_API uint32_t fin_feature_set_size(const fin_feature_set* set);
+
+/**
+ * extracts the active features of count positions from the perspective of the side to move (stm)
+ * and the other side (nstm) in compressed sparse row format: the features of position i are
+ * stored in [offsets[i], offsets[i + 1]) of both index arrays. The offsets need room for count + 1
+ * entries, the index arrays for 32 entries per position.
+ * @param threads  amount of threads to use for this call
+ * @return the total amount of features per perspective, or -1 without writing any features if the
+ *         feature set is invalid or a position has more than 32 pieces
+ */
+FIN_API int64_t fin_extract_features(const void* positions,
+                                     size_t count,
+                                     const fin_feature_set* set,
+                                     uint32_t threads,
+                                     uint64_t* offsets,
+                                     int32_t* stm,
+                                     int32_t* nstm);
+
+/**
+ * converts the offsets of fin_extract_features into the row of each feature for the coordinate
+ * format. The rows need room for offsets[count] entries.
+ */
+FIN_API void fin_features_to_rows(const uint64_t* offsets, size_t count, uint32_t* rows);
+
+/**
+ * expands count positions into dense planes of 12 x 64 values each: one plane per piece, white pawn
+ * to white king followed by black pawn to black king, with squares ordered a1, b1, ..., h8.
+ * @param type    either FIN_PLANES_U8 for one byte or FIN_PLANES_F32 for one float per square
+ * @param score   receives the score of each position, may be NULL
+ * @param wdl     receives the result of each position, may be NULL
+ * @return 0 on success
+ */
+FIN_API int fin_expand_planes(const void* positions,
+                              size_t count,
+                              int type,
+                              uint32_t threads,
+                              void* planes,
+                              int16_t* score,
+                              int8_t* wdl);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
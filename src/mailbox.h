@@ -0,0 +1,177 @@
+#ifndef MAILBOX_H
+#define MAILBOX_H
+
+#include <cstdint>
+#include <cstring>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+#include "bitboard.h"
+#include "piece.h"
+#include "piecelist.h"
+#include "position.h"
+#include "square.h"
+
+/**
+ * bulk decoding of the pieces of a position. Since the pieces are stored in the order of their
+ * squares, the pieces of each rank form a run of nibbles whose length is the popcount of the rank.
+ * With bmi2, the nibbles are widened into bytes and each run is deposited into the occupied squares
+ * of its rank using pdep, eight squares at a time. Without it, the occupied squares are visited one by one.
+ *
+ * The reverse direction builds a position from one bitboard per piece. Bit k of each nibble is set
+ * for the pieces on the squares of the k-th nibble plane, the union of the bitboards of all pieces
+ * with bit k set. With bmi2, pext gathers the bits of each plane in the order of the occupied
+ * squares and pdep spreads them into every fourth bit of the piece list, so the cost does not
+ * depend on the amount or order of the pieces.
+ */
+inline void to_mailbox_software(const Position& position, Piece* mailbox) {
+  std::memset(mailbox, (uint8_t) NO_PIECE, N_SQUARES);
+  BB occupancy = position.m_occupancy;
+  BB nibbles   = position.m_pieces.m_piece_buckets[0];
+  for (int i = 0; occupancy; i++, occupancy &= occupancy - 1) {
+    if (i == PIECES_PER_BUCKET)
+      nibbles = position.m_pieces.m_piece_buckets[1];
+    mailbox[__builtin_ctzll(occupancy)] = nibbles & 0xF;
+    nibbles >>= 4;
+  }
+}
+
+#if defined(__x86_64__)
+__attribute__((target("bmi2,popcnt"))) inline void to_mailbox_bmi2(const Position& position, Piece* mailbox) {
+  // one byte per piece, padded so the run of the last rank can be loaded as a whole word. Corrupted
+  // positions may occupy more squares than there are pieces, those receive piece 0 like in the
+  // software path
+  uint8_t pieces[N_SQUARES + 8] {};
+  for (int b = 0; b < MAX_PIECES_PER_BOARD / 8; b++) {
+    const uint64_t bytes = _pdep_u64(position.m_pieces.m_piece_buckets[b / 2] >> (32 * (b % 2)), 0x0F0F0F0F0F0F0F0FULL);
+    std::memcpy(pieces + 8 * b, &bytes, sizeof(uint64_t));
+  }
+
+  for (int r = 0; r < 8; r++) {
+    // 0xFF in each occupied byte which receives the next pieces, empty bytes become NO_PIECE
+    const uint64_t occupied = _pdep_u64(position.m_occupancy >> (8 * r), 0x0101010101010101ULL) * 0xFF;
+    uint64_t run;
+    std::memcpy(&run, pieces + bit_count(position.m_occupancy, 8 * r), sizeof(uint64_t));
+    const uint64_t squares = _pdep_u64(run, occupied) | ~occupied;
+    std::memcpy(mailbox + 8 * r, &squares, sizeof(uint64_t));
+  }
+}
+#endif
+
+/**
+ * expands the pieces of the position into a 64 entry mailbox with NO_PIECE on empty squares.
+ */
+inline void to_mailbox(const Position& position, Piece* mailbox) {
+#if defined(__x86_64__)
+  if (has_fast_bmi2()) {
+    to_mailbox_bmi2(position, mailbox);
+    return;
+  }
+#endif
+  to_mailbox_software(position, mailbox);
+}
+
+/**
+ * expands count positions into N_SQUARES entries of the output each.
+ */
+inline void to_mailboxes(const Position* positions, size_t count, Piece* mailboxes) {
+#if defined(__x86_64__)
+  if (has_fast_bmi2()) {
+    for (size_t i = 0; i < count; i++)
+      to_mailbox_bmi2(positions[i], mailboxes + i * N_SQUARES);
+    return;
+  }
+#endif
+  for (size_t i = 0; i < count; i++)
+    to_mailbox_software(positions[i], mailboxes + i * N_SQUARES);
+}
+
+/**
+ * bitboards of all pieces indexed by the piece itself, so unused piece values only fill slots which
+ * are never read.
+ */
+inline void piece_bitboards(const Position& position, BB bitboards[16]) {
+  for (int i = 0; i < 16; i++)
+    bitboards[i] = 0;
+
+  BB occupancy = position.m_occupancy;
+  BB nibbles   = position.m_pieces.m_piece_buckets[0];
+  for (int i = 0; occupancy; occupancy &= occupancy - 1, i++) {
+    if (i == PIECES_PER_BUCKET)
+      nibbles = position.m_pieces.m_piece_buckets[1];
+    bitboards[nibbles & 0xF] |= occupancy & -occupancy;
+    nibbles >>= 4;
+  }
+}
+
+/**
+ * the nibble planes of the given piece bitboards.
+ */
+inline void nibble_planes(const BB bitboards[16], BB planes[4]) {
+  for (int k = 0; k < 4; k++) {
+    planes[k] = 0;
+    for (int piece = 0; piece < 16; piece++)
+      if (piece & (1 << k))
+        planes[k] |= bitboards[piece];
+  }
+}
+
+inline void from_nibble_planes_software(const BB planes[4], BB occupancy, PieceList& pieces) {
+  pieces = PieceList {};
+  for (int i = 0; occupancy && i < MAX_PIECES_PER_BOARD; i++, occupancy &= occupancy - 1) {
+    const int sq    = __builtin_ctzll(occupancy);
+    const BB nibble = ((planes[0] >> sq) & 1) | ((planes[1] >> sq) & 1) << 1 | ((planes[2] >> sq) & 1) << 2
+                      | ((planes[3] >> sq) & 1) << 3;
+    pieces.m_piece_buckets[i / PIECES_PER_BUCKET] |= nibble << (4 * (i % PIECES_PER_BUCKET));
+  }
+}
+
+#if defined(__x86_64__)
+__attribute__((target("bmi2"))) inline void
+  from_nibble_planes_bmi2(const BB planes[4], BB occupancy, PieceList& pieces) {
+  uint64_t bits[4];
+  for (int k = 0; k < 4; k++)
+    bits[k] = _pext_u64(planes[k], occupancy);
+  for (int b = 0; b < MAX_BUCKETS; b++) {
+    BB bucket = 0;
+    for (int k = 0; k < 4; k++)
+      bucket |= _pdep_u64(bits[k] >> (PIECES_PER_BUCKET * b), 0x1111111111111111ULL << k);
+    pieces.m_piece_buckets[b] = bucket;
+  }
+}
+#endif
+
+/**
+ * sets the occupancy and pieces of the position from one bitboard per piece, indexed by the piece
+ * itself. The meta information and the result are left untouched.
+ */
+inline void from_piece_bitboards(const BB bitboards[16], Position& position) {
+  BB planes[4];
+  nibble_planes(bitboards, planes);
+  position.m_occupancy = 0;
+  for (int piece = 0; piece < 16; piece++)
+    position.m_occupancy |= bitboards[piece];
+
+#if defined(__x86_64__)
+  if (has_fast_bmi2()) {
+    from_nibble_planes_bmi2(planes, position.m_occupancy, position.m_pieces);
+    return;
+  }
+#endif
+  from_nibble_planes_software(planes, position.m_occupancy, position.m_pieces);
+}
+
+/**
+ * sets the occupancy and pieces of the position from the mailbox. The meta information and the
+ * result are left untouched.
+ */
+inline void from_mailbox(const Piece* mailbox, Position& position) {
+  BB bitboards[16] {};
+  for (Square sq = 0; sq < N_SQUARES; sq++)
+    bitboards[mailbox[sq] & 0xF] |= (BB) (mailbox[sq] != NO_PIECE) << sq;
+  from_piece_bitboards(bitboards, position);
+}
+
+#endif
@@ -1,25 +1,140 @@
+#include <fcntl.h>
+
 #include <algorithm>
 #include <cstdlib>
 #include <filesystem>
 #include <fstream>
 #include <iomanip>
 #include <iostream>
+#include <numeric>
 #include <tuple>
 #include <vector>
 
 #include "argparse.h"
+#include "augment.h"
+#include "copy.h"
 #include "dataset.h"
 #include "fenparsing.h"
+#include "filter.h"
+#include "manifest.h"
+#include "partition.h"
+#include "pipeline.h"
+#include "planes.h"
 #include "position.h"
+#include "progress.h"
+#include "reader.h"
+#include "rebalance.h"
+#include "sample.h"
+#include "scale.h"
+#include "slice.h"
+#include "split.h"
+#include "threads.h"
+#include "verify.h"
 
 using namespace std;
+
 namespace fs = filesystem;
 
+/**
+ * adds the -j option of a subcommand, which overrides the global one.
+ */
+void add_threads_argument(argparse::ArgumentParser& cmd) {
+  cmd.add_argument("-j", "--threads").scan<'i', int>().help("Threads to use, overrides the global option");
+}
+
+/**
+ * sets the amount of threads to the -j option of the subcommand if it is given.
+ */
+void apply_threads_argument(argparse::ArgumentParser& cmd) {
+  if (auto threads = cmd.present<int>("--threads"))
+    thread_count() = max(1, *threads);
+}
+
+/**
+ * a batch of fen lines and the positions parsed from them.
+ */
+struct FenBatch {
+  vector<string> fens {};
+  vector<Position> positions {};
+};
+
+/**
+ * parses the given fen files on all threads and calls sink(positions) with the positions of each
+ * batch in the order of the files.
+ */
+template<typename F>
+bool convert_fens(const vector<string>& inputs, F&& sink) {
+  FenSource source {inputs};
+  return run_pipeline<FenBatch>(
+    "convert",
+    [&](FenBatch& batch) { return source.next(batch.fens); },
+    [](FenBatch& batch) { parse_fens(batch.fens, batch.positions); },
+    [&](FenBatch& batch) { return sink(batch.positions); },
+    true);
+}
+
+/**
+ * adds the options of a PositionFilter to the given command.
+ */
+void add_filter_arguments(argparse::ArgumentParser& cmd) {
+  cmd.add_argument("--min-pieces").default_value(0).scan<'i', int>().help("Minimum amount of pieces");
+  cmd.add_argument("--max-pieces")
+    .default_value(MAX_PIECES_PER_BOARD)
+    .scan<'i', int>()
+    .help("Maximum amount of pieces");
+  cmd.add_argument("--min-score").default_value((int) INT16_MIN).scan<'i', int>().help("Minimum score");
+  cmd.add_argument("--max-score").default_value((int) INT16_MAX).scan<'i', int>().help("Maximum score");
+  cmd.add_argument("--wdl").append().help("Results to keep. Either 'loss', 'draw' or 'win'. Repeat for multiple");
+  cmd.add_argument("--stm").append().help("Side to move to keep. Either 'white' or 'black'. Repeat for both");
+}
+
+/**
+ * reads the options added by add_filter_arguments.
+ * @return false if an option is invalid
+ */
+bool parse_filter_arguments(argparse::ArgumentParser& cmd, PositionFilter& filter) {
+  filter.min_pieces = cmd.get<int>("--min-pieces");
+  filter.max_pieces = cmd.get<int>("--max-pieces");
+  filter.min_score  = cmd.get<int>("--min-score");
+  filter.max_score  = cmd.get<int>("--max-score");
+
+  auto to_mask = [](const vector<string>& names, const vector<string>& allowed, uint32_t& mask) {
+    if (names.empty())
+      return true;
+    mask = 0;
+    for (const auto& name : names) {
+      auto it = find(allowed.begin(), allowed.end(), name);
+      if (it == allowed.end())
+        return false;
+      mask |= 1 << (it - allowed.begin());
+    }
+    return true;
+  };
+  return to_mask(cmd.get<vector<string>>("--wdl"), {"loss", "draw", "win"}, filter.wdl)
+         && to_mask(cmd.get<vector<string>>("--stm"), {"white", "black"}, filter.stm);
+}
+
 int main(int argc, char* argv[]) {
   argparse::ArgumentParser program("fin-tool");
+  program.add_argument("--verify-reads")
+    .default_value(false)
+    .implicit_value(true)
+    .help("Check the checksum of every block read from .finz files");
+  program.add_argument("-j", "--threads")
+    .default_value(thread_count())
+    .scan<'i', int>()
+    .help("Threads shared by all passes of the subcommand");
+  program.add_argument("--progress")
+    .default_value(string("text"))
+    .help("Progress output. Either 'text' on stdout, 'json' lines on stderr or 'none'");
+  program.add_argument("--progress-interval")
+    .default_value(1.0)
+    .scan<'g', double>()
+    .help("Seconds between progress reports");
 
   argparse::ArgumentParser counts_cmd("counts");
   counts_cmd.add_description("Get the count of positions in each file");
+  add_threads_argument(counts_cmd);
   counts_cmd.add_argument("files").help("Files to read").remaining();
 
   argparse::ArgumentParser convert_cmd("convert");
@@ -27,11 +142,13 @@ int main(int argc, char* argv[]) {
     "Convert between fen and fin files. Input and output type determined based on output file name (.fin or .fens). "
     "Fen format should be {fen} [result] {search}.");
   convert_cmd.add_argument("-o", "--output").required().help("Output file name. Must contain either '.fin' or '.fens'");
+  add_threads_argument(convert_cmd);
   convert_cmd.add_argument("files").help("Files to convert").remaining();
 
   argparse::ArgumentParser combine_cmd("combine");
   combine_cmd.add_description("Combine many fin files into one.");
   combine_cmd.add_argument("-o", "--output").required().help("Output file name.");
+  add_threads_argument(combine_cmd);
   combine_cmd.add_argument("files").help("Files to combine").remaining();
 
   argparse::ArgumentParser shuffle_cmd("shuffle");
@@ -40,12 +157,199 @@ int main(int argc, char* argv[]) {
   shuffle_cmd.add_argument("-t", "--tmp")
     .default_value("/tmp")
     .help("Temporary directory to write files into during shuffling");
+  add_threads_argument(shuffle_cmd);
   shuffle_cmd.add_argument("files").help("Files to shuffle").remaining();
 
+  argparse::ArgumentParser fit_scale_cmd("fit-scale");
+  fit_scale_cmd.add_description("Fit the scale K of sigmoid(score / K) against the game results.");
+  fit_scale_cmd.add_argument("-l", "--loss").default_value("mse").help("Loss to minimise. Either 'mse' or 'ce'");
+  fit_scale_cmd.add_argument("-b", "--buckets")
+    .default_value(1)
+    .scan<'i', int>()
+    .help("Amount of piece count buckets to fit separately");
+  fit_scale_cmd.add_argument("--min").default_value(1.0).scan<'g', double>().help("Lower bound for K");
+  fit_scale_cmd.add_argument("--max").default_value(2000.0).scan<'g', double>().help("Upper bound for K");
+  fit_scale_cmd.add_argument("--curve")
+    .default_value(16)
+    .scan<'i', int>()
+    .help("Amount of points at which the loss curve is reported");
+  add_threads_argument(fit_scale_cmd);
+  fit_scale_cmd.add_argument("files").help("Files to read").remaining();
+
+  argparse::ArgumentParser sample_cmd("sample");
+  sample_cmd.add_description("Sample positions uniformly without replacement from many fin files.");
+  sample_cmd.add_argument("-o", "--output").required().help("Output file name.");
+  sample_cmd.add_argument("-n", "--count").required().scan<'u', uint64_t>().help("Amount of positions to sample");
+  sample_cmd.add_argument("-s", "--seed")
+    .default_value((uint64_t) random_device()())
+    .scan<'u', uint64_t>()
+    .help("Seed for the sampling");
+  add_threads_argument(sample_cmd);
+  sample_cmd.add_argument("files").help("Files to sample from").remaining();
+
+  argparse::ArgumentParser split_cmd("split");
+  split_cmd.add_description(
+    "Split fin files into partitions (e.g. train/validation/test) based on a hash of each position, so the same "
+    "position always lands in the same partition, or into contiguous ranges which are copied by the kernel.");
+  split_cmd.add_argument("-o", "--output").required().append().help("Output file name. Repeat once per partition");
+  split_cmd.add_argument("-w", "--weight")
+    .append()
+    .scan<'g', double>()
+    .help("Relative size of each partition. Repeat once per output. Defaults to equal sizes");
+  split_cmd.add_argument("--by")
+    .default_value("hash")
+    .help("Either 'hash' or 'range'. Ranges keep the order of the positions and write raw fin files");
+  split_cmd.add_argument("-s", "--seed").default_value((uint64_t) 0).scan<'u', uint64_t>().help("Seed of the hash");
+  add_threads_argument(split_cmd);
+  split_cmd.add_argument("files").help("Files to split").remaining();
+
+  argparse::ArgumentParser partition_cmd("partition");
+  partition_cmd.add_description("Partition fin files into one file per piece count bucket or material signature.");
+  partition_cmd.add_argument("-o", "--output")
+    .required()
+    .help("Output file name format. Each '$' is replaced with the label of the partition");
+  partition_cmd.add_argument("--by").default_value("pieces").help("Partition key. Either 'pieces' or 'material'");
+  partition_cmd.add_argument("-b", "--buckets")
+    .default_value(0)
+    .scan<'i', int>()
+    .help("Amount of piece count buckets. 0 uses one bucket per piece count");
+  add_threads_argument(partition_cmd);
+  partition_cmd.add_argument("files").help("Files to partition").remaining();
+
+  argparse::ArgumentParser rebalance_cmd("rebalance");
+  rebalance_cmd.add_description(
+    "Resample fin files to match a target distribution over score and/or piece count buckets. The target is the "
+    "product of the per dimension weights, which default to a uniform distribution.");
+  rebalance_cmd.add_argument("-o", "--output").required().help("Output file name.");
+  rebalance_cmd.add_argument("--by").default_value("score").help("Either 'score', 'pieces' or 'both'");
+  rebalance_cmd.add_argument("--score-width").default_value(100).scan<'i', int>().help("Width of the score buckets");
+  rebalance_cmd.add_argument("--score-limit")
+    .default_value(1000)
+    .scan<'i', int>()
+    .help("Scores are clamped into [-limit, limit) before bucketing. Twice the limit must be a multiple of the width");
+  rebalance_cmd.add_argument("--piece-buckets")
+    .default_value(8)
+    .scan<'i', int>()
+    .help("Amount of piece count buckets");
+  rebalance_cmd.add_argument("--score-weight")
+    .append()
+    .scan<'g', double>()
+    .help("Target weight of each score bucket in ascending order. Repeat once per bucket");
+  rebalance_cmd.add_argument("--piece-weight")
+    .append()
+    .scan<'g', double>()
+    .help("Target weight of each piece count bucket in ascending order. Repeat once per bucket");
+  rebalance_cmd.add_argument("-s", "--seed")
+    .default_value((uint64_t) random_device()())
+    .scan<'u', uint64_t>()
+    .help("Seed for the resampling");
+  add_threads_argument(rebalance_cmd);
+  rebalance_cmd.add_argument("files").help("Files to resample").remaining();
+
+  argparse::ArgumentParser compress_cmd("compress");
+  compress_cmd.add_description(
+    "Combine fin files into one block compressed .finz file. All subcommands read .finz files transparently, "
+    "combine can be used to decompress them.");
+  compress_cmd.add_argument("-o", "--output").required().help("Output file name.");
+  compress_cmd.add_argument("-l", "--level").default_value(1).scan<'i', int>().help("Compression level (0-9)");
+  compress_cmd.add_argument("-e", "--encoding")
+    .default_value("packed")
+    .help("Encoding of the positions within a block. Either 'packed', 'delta', 'entropy', 'columns' or 'rows'");
+  compress_cmd.add_argument("--block-size")
+    .default_value(BLOCK_POSITIONS)
+    .scan<'i', int>()
+    .help("Amount of positions per block");
+  add_threads_argument(compress_cmd);
+  compress_cmd.add_argument("files").help("Files to compress").remaining();
+
+  argparse::ArgumentParser verify_cmd("verify");
+  verify_cmd.add_description(
+    "Verify the block checksums of .finz files, or the size of raw fin files against their header.");
+  verify_cmd.add_argument("-d", "--decode")
+    .default_value(false)
+    .implicit_value(true)
+    .help("Also decode all positions and check them for plausibility");
+  add_threads_argument(verify_cmd);
+  verify_cmd.add_argument("files").help("Files to verify").remaining();
+
+  argparse::ArgumentParser filter_cmd("filter");
+  filter_cmd.add_description(
+    "Keep the positions matching all given conditions. Blocks of .finz files which cannot match are skipped "
+    "using their block stats.");
+  filter_cmd.add_argument("-o", "--output").required().help("Output file name.");
+  add_filter_arguments(filter_cmd);
+  add_threads_argument(filter_cmd);
+  filter_cmd.add_argument("files").help("Files to filter").remaining();
+
+  argparse::ArgumentParser stats_cmd("stats");
+  stats_cmd.add_description(
+    "Summarise the positions matching all given conditions. Blocks of .finz files are answered from their block "
+    "stats where possible.");
+  add_filter_arguments(stats_cmd);
+  add_threads_argument(stats_cmd);
+  stats_cmd.add_argument("files").help("Files to summarise").remaining();
+
+  argparse::ArgumentParser manifest_cmd("manifest");
+  manifest_cmd.add_description(
+    "Create a manifest listing fin files and their position counts. Manifests can be passed to all subcommands "
+    "in place of the files they list.");
+  manifest_cmd.add_argument("-o", "--output").required().help("Output file name, usually ending in .finm");
+  add_threads_argument(manifest_cmd);
+  manifest_cmd.add_argument("files").help("Files to list").remaining();
+
+  argparse::ArgumentParser slice_cmd("slice");
+  slice_cmd.add_description(
+    "Extract the positions [start, end) of the concatenation of the given files into a raw fin file. Ranges of raw "
+    "inputs are copied by the kernel.");
+  slice_cmd.add_argument("-o", "--output").required().help("Output file name.");
+  slice_cmd.add_argument("--start").default_value((uint64_t) 0).scan<'u', uint64_t>().help("First position to keep");
+  slice_cmd.add_argument("--end")
+    .default_value(UINT64_MAX)
+    .scan<'u', uint64_t>()
+    .help("Position after the last one to keep, defaults to the end of the input");
+  add_threads_argument(slice_cmd);
+  slice_cmd.add_argument("files").help("Files to slice").remaining();
+
+  argparse::ArgumentParser export_cmd("export");
+  export_cmd.add_description(
+    "Export dense input planes (12 x 64 per position) with score and wdl targets into numpy .npy files named "
+    "<output>_planes.npy, <output>_score.npy and <output>_wdl.npy.");
+  export_cmd.add_argument("-o", "--output").required().help("Prefix of the output file names");
+  export_cmd.add_argument("--dtype").default_value("u8").help("Type of the planes. Either 'u8' or 'f32'");
+  export_cmd.add_argument("--shard-size")
+    .default_value((uint64_t) 0)
+    .scan<'u', uint64_t>()
+    .help("Positions per output shard, numbered <output>_<array>_<shard>.npy. 0 writes a single shard");
+  add_threads_argument(export_cmd);
+  export_cmd.add_argument("files").help("Files to export").remaining();
+
+  argparse::ArgumentParser augment_cmd("augment");
+  augment_cmd.add_description(
+    "Write each position together with its mirrored and / or color flipped variants. Mirroring swaps the files a "
+    "and h and drops the castling rights, flipping swaps the colors and negates the score and the result.");
+  augment_cmd.add_argument("-o", "--output").required().help("Output file name.");
+  augment_cmd.add_argument("--mirror").default_value(false).implicit_value(true).help("Add mirrored positions");
+  augment_cmd.add_argument("--flip").default_value(false).implicit_value(true).help("Add color flipped positions");
+  add_threads_argument(augment_cmd);
+  augment_cmd.add_argument("files").help("Files to augment").remaining();
+
   program.add_subparser(counts_cmd);
   program.add_subparser(convert_cmd);
   program.add_subparser(combine_cmd);
   program.add_subparser(shuffle_cmd);
+  program.add_subparser(fit_scale_cmd);
+  program.add_subparser(sample_cmd);
+  program.add_subparser(split_cmd);
+  program.add_subparser(partition_cmd);
+  program.add_subparser(rebalance_cmd);
+  program.add_subparser(compress_cmd);
+  program.add_subparser(verify_cmd);
+  program.add_subparser(filter_cmd);
+  program.add_subparser(stats_cmd);
+  program.add_subparser(manifest_cmd);
+  program.add_subparser(slice_cmd);
+  program.add_subparser(export_cmd);
+  program.add_subparser(augment_cmd);
 
   try {
     program.parse_args(argc, argv);
@@ -55,31 +359,51 @@ int main(int argc, char* argv[]) {
     return EXIT_FAILURE;
   }
 
+  verify_reads() = program.get<bool>("--verify-reads");
+  thread_count() = max(1, program.get<int>("--threads"));
+
+  ProgressMode progress_mode {};
+  if (!parse_progress_mode(program.get("--progress"), progress_mode)) {
+    cerr << "Invalid progress output. Either 'text', 'json' or 'none'." << endl;
+    return EXIT_FAILURE;
+  }
+  ProgressReporter reporter {progress_mode, max(0.01, program.get<double>("--progress-interval"))};
+
   /**
    * Counts
    */
   if (program.is_subcommand_used(counts_cmd)) {
-    auto inputs = counts_cmd.get<vector<string>>("files");
+    vector<string> inputs {};
+    if (!expand_manifests(counts_cmd.get<vector<string>>("files"), inputs))
+      return EXIT_FAILURE;
+
+    apply_threads_argument(counts_cmd);
+
+    // read all headers in parallel, files which cannot be read keep a count of -1
+    vector<int64_t> counts(inputs.size(), -1);
+    parallel_tasks(inputs.size(), [&](size_t i) {
+      fs::path input_path(inputs[i]);
+
+      if (!fs::exists(input_path) || fs::is_directory(input_path))
+        return;
+
+      FinReader reader {inputs[i]};
+      if (reader.is_open())
+        counts[i] = reader.header.position_count;
+    });
 
-    Header header {};
     uint64_t total = 0;
 
     auto longest =
       max_element(inputs.begin(), inputs.end(), [](const auto& a, const auto& b) { return a.size() < b.size(); });
     auto max_size = longest->size();
 
-    for (const auto& input : inputs) {
-      fs::path input_path(input);
-
-      if (!fs::exists(input_path) || fs::is_directory(input_path))
+    for (size_t i = 0; i < inputs.size(); i++) {
+      if (counts[i] < 0)
         continue;
 
-      ifstream fin(input_path, ios::binary | ios::in);
-      fin.read((char*) &header, sizeof(Header));
-      fin.close();
-
-      cout << setw(max_size) << input << " " << setw(12) << header.position_count << endl;
-      total += header.position_count;
+      cout << setw(max_size) << inputs[i] << " " << setw(12) << counts[i] << endl;
+      total += counts[i];
     }
 
     cout << setw(max_size) << "Total"
@@ -97,6 +421,37 @@ int main(int argc, char* argv[]) {
     bool to_fen = (output_name.find(".fens") != string::npos);
     fs::path output_path(output_name);
 
+    apply_threads_argument(convert_cmd);
+
+    // fen -> block compressed fin, using the game delta encoding since fens are usually ordered by game
+    if (is_block_file_name(output_name)) {
+      if (fs::exists(output_path)) {
+        cerr << "Output file " << output_name << " already exists. Block compressed files cannot be appended to."
+             << endl;
+        return EXIT_FAILURE;
+      }
+
+      BlockOptions options {};
+      options.encoding = BLOCK_DELTA;
+      FinWriter writer {output_name, 1 << 16, options};
+      if (!writer.is_open())
+        return EXIT_FAILURE;
+
+      const bool converted = convert_fens(inputs, [&](const vector<Position>& positions) {
+        for (const Position& p : positions)
+          writer.write(p);
+        return true;
+      });
+      if (!writer.close() || !converted) {
+        cerr << "Failed to convert into " << output_name << endl;
+        return EXIT_FAILURE;
+      }
+
+      cout << "Successfully converted " << inputs.size() << " file(s) into " << output_name << " ("
+           << writer.header.position_count << " pos)" << endl;
+      return EXIT_SUCCESS;
+    }
+
     // fen -> fin
     if (to_bin) {
       Header out_header {};
@@ -121,29 +476,18 @@ int main(int argc, char* argv[]) {
       ofstream fout(output_path, ios::binary | ios::in | ios::out);
       fout.seekp(sizeof(Header) + sizeof(Position) * out_header.position_count);
 
-      for (const auto& input : inputs) {
-        fs::path input_path(input);
-
-        if (!fs::exists(input_path)) {
-          cout << input_path << " does not exist, skipping!" << endl;
-          continue;
-        } else if (fs::is_directory(input_path)) {
-          cout << input_path << " is a directory, skipping!" << endl;
-          continue;
-        } else {
-          cout << "Reading from " << input_path << endl;
-        }
-
-        ifstream fin(input_path);
-
-        // TODO: Buffer the writes
-        for (string fen; getline(fin, fen);) {
-          auto pos = parse_fen(fen);
-          fout.write((char*) &pos, sizeof(Position));
-          out_header.position_count++;
-        }
-
-        fin.close();
+      StageCounters& stage = progress_stage("write");
+      const bool converted = convert_fens(inputs, [&](const vector<Position>& positions) {
+        fout.write((char*) positions.data(), sizeof(Position) * positions.size());
+        out_header.position_count += positions.size();
+        stage.add(positions.size(), sizeof(Position) * positions.size());
+        return fout.good();
+      });
+
+      // the header keeps the previous count, so positions of a failed conversion are not counted
+      if (!converted) {
+        cerr << "Failed to convert into " << output_name << endl;
+        return EXIT_FAILURE;
       }
 
       fout.seekp(0);
@@ -168,7 +512,9 @@ int main(int argc, char* argv[]) {
    */
   else if (program.is_subcommand_used(combine_cmd)) {
     auto output_name = combine_cmd.get("--output");
-    auto inputs      = combine_cmd.get<vector<string>>("files");
+    vector<string> inputs {};
+    if (!expand_manifests(combine_cmd.get<vector<string>>("files"), inputs))
+      return EXIT_FAILURE;
 
     fs::path output_path(output_name);
 
@@ -177,13 +523,20 @@ int main(int argc, char* argv[]) {
       return EXIT_FAILURE;
     }
 
-    Header in_header {};
+    apply_threads_argument(combine_cmd);
+
     Header out_header {};
     out_header.position_count = 0;
 
-    ofstream fout(output_path, ios::binary | ios::out);
-    fout.write((char*) &out_header, sizeof(Header));
+    int out = open(output_name.c_str(), O_WRONLY | O_CREAT | O_EXCL, 0644);
+    if (out < 0) {
+      cerr << "Could not open " << output_name << endl;
+      return EXIT_FAILURE;
+    }
 
+    // check all inputs first so each one can be written to its offset in parallel
+    vector<string> files {};
+    vector<off_t> offsets {};
     for (const auto& input : inputs) {
       fs::path input_path(input);
 
@@ -197,19 +550,63 @@ int main(int argc, char* argv[]) {
         cout << "Reading from " << input_path << endl;
       }
 
-      ifstream fin(input_path, ios::binary | ios::in);
-      fin.read((char*) &in_header, sizeof(Header));
+      FinReader reader {input};
+      if (!reader.is_open()) {
+        cout << input_path << " could not be read, skipping!" << endl;
+        continue;
+      }
 
-      cout << "File contains " << in_header.position_count << " position(s)" << endl;
-      out_header.position_count += in_header.position_count;
+      cout << "File contains " << reader.header.position_count << " position(s)" << endl;
 
-      fout << fin.rdbuf();
-      fin.close();
+      files.push_back(input);
+      offsets.push_back(sizeof(Header) + out_header.position_count * sizeof(Position));
+      out_header.position_count += reader.header.position_count;
     }
 
-    fout.seekp(0);
-    fout.write((char*) &out_header, sizeof(Header));
-    fout.close();
+    atomic<bool> success {true};
+    parallel_tasks(
+      files.size(),
+      [&](size_t i) {
+        FinReader reader {files[i]};
+        uint64_t expected = reader.header.position_count;
+
+        // block compressed files need to be decompressed, raw files are copied by the kernel. Only the
+        // complete positions of truncated files are copied
+        if (reader.block == nullptr) {
+          if (!reader.is_open()
+              || !copy_range(fileno(reader.f), sizeof(Header), out, offsets[i], expected * sizeof(Position))) {
+            cerr << "Could not copy " << files[i] << " into " << output_name << endl;
+            success = false;
+          }
+          return;
+        }
+
+        vector<Position> positions {};
+        uint64_t written = 0;
+        while (reader.read(positions, 1 << 20) > 0 && written + positions.size() <= expected) {
+          ssize_t bytes = sizeof(Position) * positions.size();
+          if (pwrite(out, positions.data(), bytes, offsets[i] + written * sizeof(Position)) != bytes)
+            break;
+          written += positions.size();
+        }
+        if (written != expected) {
+          cerr << "Could not read all positions of " << files[i] << endl;
+          success = false;
+        }
+      },
+      thread_count());
+
+    if (!success) {
+      close(out);
+      return EXIT_FAILURE;
+    }
+
+    bool written = pwrite(out, &out_header, sizeof(Header), 0) == (ssize_t) sizeof(Header);
+    close(out);
+    if (!written) {
+      cerr << "Could not write to " << output_name << endl;
+      return EXIT_FAILURE;
+    }
 
     cout << "Successfully combined " << inputs.size() << " file(s) into " << output_name << " ("
          << out_header.position_count << " pos)" << endl;
@@ -222,7 +619,11 @@ int main(int argc, char* argv[]) {
   else if (program.is_subcommand_used(shuffle_cmd)) {
     auto output_name  = shuffle_cmd.get("--output");
     auto tmp_dir_name = shuffle_cmd.get("--tmp");
-    auto inputs       = shuffle_cmd.get<vector<string>>("files");
+    vector<string> inputs {};
+    if (!expand_manifests(shuffle_cmd.get<vector<string>>("files"), inputs))
+      return EXIT_FAILURE;
+
+    apply_threads_argument(shuffle_cmd);
 
     auto inputs_it = inputs.begin();
     while (inputs_it != inputs.end()) {
@@ -240,11 +641,8 @@ int main(int argc, char* argv[]) {
     for (const auto& input : inputs) {
       fs::path input_path(input);
 
-      Header in_header {};
-      fstream fin(input_path, ios::binary | ios::in);
-      fin.read((char*) &in_header, sizeof(Header));
-      total_positions += in_header.position_count;
-      fin.close();
+      FinReader reader {input};
+      total_positions += reader.header.position_count;
     }
 
     // Hardcoded to 4gb per temp file
@@ -272,33 +670,55 @@ int main(int argc, char* argv[]) {
 
     random_device rd;
     mt19937 gen(rd());
-    uniform_int_distribution<> distrib(1, total_files);
 
-    for (const auto& input : inputs) {
-      fs::path input_path(input);
-
-      fstream fin(input_path, ios::binary | ios::in);
-      Header in_header {};
-      fin.read((char*) &in_header, sizeof(Header));
-
-      cout << "Reading from " << input_path << " with " << in_header.position_count << " position(s)" << endl;
-
-      for (uint64_t i = 0; i < in_header.position_count; i++) {
-        Position pos {};
-        fin.read((char*) &pos, sizeof(Position));
-
-        size_t rand_idx        = distrib(gen) - 1;
-        auto& [_, fout, count] = tmp_files[rand_idx];
-        fout.write((char*) &pos, sizeof(Position));
-        count++;
-      }
-
-      fin.close();
-    }
+    // the workers draw the destinations of each chunk and group its positions per temporary file, so
+    // the sink writes each temporary file at once
+    struct ShuffleBatch {
+      uint64_t seed = 0;
+      vector<Position> positions {};
+      vector<Position> grouped {};
+      vector<uint32_t> destinations {};
+      vector<size_t> starts {};
+    };
+
+    FinSource source {inputs};
+    StageCounters& stage = progress_stage("write");
+    bool written         = run_pipeline<ShuffleBatch>(
+      "shuffle",
+      [&](ShuffleBatch& batch) {
+        batch.seed = (uint64_t) gen() << 32 | gen();
+        return source.next(batch.positions);
+      },
+      [&](ShuffleBatch& batch) {
+        mt19937_64 local(mix_hash(batch.seed));
+        uniform_int_distribution<uint32_t> distrib(0, total_files - 1);
+        batch.destinations.resize(batch.positions.size());
+        for (uint32_t& destination : batch.destinations)
+          destination = distrib(local);
+        group_by_destination(batch.positions, batch.destinations, total_files, batch.grouped, batch.starts);
+      },
+      [&](ShuffleBatch& batch) {
+        for (size_t f = 0; f < total_files; f++) {
+          auto& [_, fout, count] = tmp_files[f];
+          const size_t n         = batch.starts[f + 1] - batch.starts[f];
+          fout.write((char*) &batch.grouped[batch.starts[f]], sizeof(Position) * n);
+          count += n;
+          if (!fout.good())
+            return false;
+        }
+        stage.add(batch.positions.size(), sizeof(Position) * batch.positions.size());
+        return true;
+      },
+      false);
 
     for (auto& [_, fout, __] : tmp_files)
       fout.close();
 
+    if (!written) {
+      cerr << "Could not write the temporary files." << endl;
+      return EXIT_FAILURE;
+    }
+
     fs::path output_path(output_name);
     ofstream fout(output_path, ios::binary | ios::out);
 
@@ -314,12 +734,22 @@ int main(int argc, char* argv[]) {
 
       cout << "Loading " << file_path << " into memory for shuffling. Position count: " << count << endl;
 
-      vector<Position> positions {};
+      // the buffer of the previous file is recycled, so its pages are not faulted in and cleared again
+      PositionBuffer positions {};
       positions.resize(count);
 
       fin.read((char*) &positions[0], sizeof(Position) * count);
       fin.close();
 
+      // the recycled buffer is not cleared, so the missing part of a short read would hold stale positions
+      if ((uint64_t) fin.gcount() != sizeof(Position) * count) {
+        cerr << "Could not read " << file_path << " completely. Removing the incomplete output " << output_name
+             << endl;
+        fout.close();
+        fs::remove(output_path);
+        return EXIT_FAILURE;
+      }
+
       shuffle(positions.begin(), positions.end(), mt19937(random_device()()));
 
       cout << "Loading + shuffling complete, writing back to disk." << endl;
@@ -334,4 +764,499 @@ int main(int argc, char* argv[]) {
     cout << "Successfully shuffled " << inputs.size() << " file(s) with " << total_positions << " position(s) into "
          << output_name << endl;
   }
+
+  /**
+   * Fit the eval to wdl scale
+   */
+  else if (program.is_subcommand_used(fit_scale_cmd)) {
+    auto loss    = fit_scale_cmd.get("--loss");
+    auto buckets = fit_scale_cmd.get<int>("--buckets");
+    vector<string> inputs {};
+    if (!expand_manifests(fit_scale_cmd.get<vector<string>>("files"), inputs))
+      return EXIT_FAILURE;
+
+    if (loss != "mse" && loss != "ce") {
+      cerr << "Unknown loss " << loss << ". Must be either 'mse' or 'ce'." << endl;
+      return EXIT_FAILURE;
+    }
+    if (buckets < 1 || fit_scale_cmd.get<double>("--min") <= 0
+        || fit_scale_cmd.get<double>("--min") >= fit_scale_cmd.get<double>("--max")) {
+      cerr << "Invalid bucket count or scale bounds." << endl;
+      return EXIT_FAILURE;
+    }
+
+    apply_threads_argument(fit_scale_cmd);
+    fit_scale(inputs,
+              loss == "mse" ? MSE : CROSS_ENTROPY,
+              buckets,
+              fit_scale_cmd.get<double>("--min"),
+              fit_scale_cmd.get<double>("--max"),
+              max(0, fit_scale_cmd.get<int>("--curve")));
+    return EXIT_SUCCESS;
+  }
+
+  /**
+   * Sample positions from many fins
+   */
+  else if (program.is_subcommand_used(sample_cmd)) {
+    auto output_name = sample_cmd.get("--output");
+    auto inputs      = sample_cmd.get<vector<string>>("files");
+
+    if (fs::exists(output_name)) {
+      cerr << "Output file " << output_name << " already exists. Aborting to prevent accidental overwrite." << endl;
+      return EXIT_FAILURE;
+    }
+
+    apply_threads_argument(sample_cmd);
+    if (!sample(inputs, output_name, sample_cmd.get<uint64_t>("--count"), sample_cmd.get<uint64_t>("--seed"))) {
+      cerr << "Failed to sample into " << output_name << endl;
+      return EXIT_FAILURE;
+    }
+
+    cout << "Successfully sampled " << inputs.size() << " file(s) into " << output_name << endl;
+    return EXIT_SUCCESS;
+  }
+
+  /**
+   * Split fins into hash based partitions
+   */
+  else if (program.is_subcommand_used(split_cmd)) {
+    auto outputs = split_cmd.get<vector<string>>("--output");
+    auto weights = split_cmd.get<vector<double>>("--weight");
+    vector<string> inputs {};
+    if (!expand_manifests(split_cmd.get<vector<string>>("files"), inputs))
+      return EXIT_FAILURE;
+
+    if (weights.empty())
+      weights.resize(outputs.size(), 1.0);
+
+    if (weights.size() != outputs.size()
+        || any_of(weights.begin(), weights.end(), [](double w) { return !(w >= 0); })
+        || accumulate(weights.begin(), weights.end(), 0.0) <= 0) {
+      cerr << "Expected one non-negative weight per output." << endl;
+      return EXIT_FAILURE;
+    }
+
+    for (const auto& output : outputs) {
+      if (fs::exists(output)) {
+        cerr << "Output file " << output << " already exists. Aborting to prevent accidental overwrite." << endl;
+        return EXIT_FAILURE;
+      }
+    }
+
+    auto by = split_cmd.get("--by");
+    if (by != "hash" && by != "range") {
+      cerr << "Invalid split mode." << endl;
+      return EXIT_FAILURE;
+    }
+    if (by == "range" && any_of(outputs.begin(), outputs.end(), is_block_file_name)) {
+      cerr << "Range splits write raw fin files, compress them afterwards." << endl;
+      return EXIT_FAILURE;
+    }
+
+    apply_threads_argument(split_cmd);
+
+    if (by == "range") {
+      Manifest manifest {};
+      if (!Manifest::from_files(inputs, manifest))
+        return EXIT_FAILURE;
+      if (!split_by_range(manifest, outputs, weights, 0, manifest.size())) {
+        cerr << "Failed to write the output files." << endl;
+        return EXIT_FAILURE;
+      }
+    } else if (!split_by_hash(inputs, outputs, weights, split_cmd.get<uint64_t>("--seed"))) {
+      cerr << "Failed to write the output files." << endl;
+      return EXIT_FAILURE;
+    }
+
+    cout << "Successfully split " << inputs.size() << " file(s) into " << outputs.size() << " partition(s)" << endl;
+    return EXIT_SUCCESS;
+  }
+
+  /**
+   * Partition fins by material
+   */
+  else if (program.is_subcommand_used(partition_cmd)) {
+    auto out_format = partition_cmd.get("--output");
+    auto key        = partition_cmd.get("--by");
+    auto buckets    = partition_cmd.get<int>("--buckets");
+    vector<string> inputs {};
+    if (!expand_manifests(partition_cmd.get<vector<string>>("files"), inputs))
+      return EXIT_FAILURE;
+
+    if (out_format.find('$') == string::npos) {
+      cerr << "Output file name format must contain a '$'." << endl;
+      return EXIT_FAILURE;
+    }
+    if ((key != "pieces" && key != "material") || buckets < 0) {
+      cerr << "Invalid partition key or bucket count." << endl;
+      return EXIT_FAILURE;
+    }
+
+    apply_threads_argument(partition_cmd);
+    if (!partition(inputs, out_format, key == "material" ? MATERIAL : PIECE_COUNT, buckets)) {
+      cerr << "Failed to write the partitions." << endl;
+      return EXIT_FAILURE;
+    }
+
+    cout << "Successfully partitioned " << inputs.size() << " file(s)" << endl;
+    return EXIT_SUCCESS;
+  }
+
+  /**
+   * Rebalance fins to a target distribution
+   */
+  else if (program.is_subcommand_used(rebalance_cmd)) {
+    auto output_name   = rebalance_cmd.get("--output");
+    auto by            = rebalance_cmd.get("--by");
+    auto score_width   = rebalance_cmd.get<int>("--score-width");
+    auto score_limit   = rebalance_cmd.get<int>("--score-limit");
+    auto piece_buckets = rebalance_cmd.get<int>("--piece-buckets");
+    auto score_weights = rebalance_cmd.get<vector<double>>("--score-weight");
+    auto piece_weights = rebalance_cmd.get<vector<double>>("--piece-weight");
+    vector<string> inputs {};
+    if (!expand_manifests(rebalance_cmd.get<vector<string>>("files"), inputs))
+      return EXIT_FAILURE;
+
+    if ((by != "score" && by != "pieces" && by != "both") || score_width <= 0 || score_limit <= 0
+        || (2 * score_limit) % score_width != 0 || piece_buckets < 1) {
+      cerr << "Invalid bucket configuration." << endl;
+      return EXIT_FAILURE;
+    }
+
+    RebalanceBins bins {by != "pieces", score_width, score_limit, by != "score" ? (size_t) piece_buckets : 1};
+
+    if (score_weights.empty())
+      score_weights.resize(bins.score_bins, 1.0);
+    if (piece_weights.empty())
+      piece_weights.resize(bins.piece_bins, 1.0);
+    if (score_weights.size() != bins.score_bins || piece_weights.size() != bins.piece_bins) {
+      cerr << "Expected " << bins.score_bins << " score weight(s) and " << bins.piece_bins << " piece weight(s)."
+           << endl;
+      return EXIT_FAILURE;
+    }
+
+    vector<double> target(bins.size());
+    for (size_t c = 0; c < bins.size(); c++)
+      target[c] = score_weights[c / bins.piece_bins] * piece_weights[c % bins.piece_bins];
+
+    if (fs::exists(output_name)) {
+      cerr << "Output file " << output_name << " already exists. Aborting to prevent accidental overwrite." << endl;
+      return EXIT_FAILURE;
+    }
+
+    apply_threads_argument(rebalance_cmd);
+    if (!rebalance(inputs, output_name, bins, target, rebalance_cmd.get<uint64_t>("--seed"))) {
+      cerr << "Failed to write " << output_name << endl;
+      return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+  }
+
+  /**
+   * Compress fins into a block compressed file
+   */
+  else if (program.is_subcommand_used(compress_cmd)) {
+    auto output_name = compress_cmd.get("--output");
+    auto level       = compress_cmd.get<int>("--level");
+    auto encoding    = compress_cmd.get("--encoding");
+    auto block_size  = compress_cmd.get<int>("--block-size");
+    vector<string> inputs {};
+    if (!expand_manifests(compress_cmd.get<vector<string>>("files"), inputs))
+      return EXIT_FAILURE;
+
+    BlockOptions options {};
+    if (level < 0 || level > 9 || block_size < 1 || !parse_block_encoding(encoding, options.encoding)) {
+      cerr << "Invalid compression level, encoding or block size." << endl;
+      return EXIT_FAILURE;
+    }
+    if (fs::exists(output_name)) {
+      cerr << "Output file " << output_name << " already exists. Aborting to prevent accidental overwrite." << endl;
+      return EXIT_FAILURE;
+    }
+
+    apply_threads_argument(compress_cmd);
+
+    options.compression = level == 0 ? BLOCK_UNCOMPRESSED : BLOCK_ZLIB;
+    options.level       = level;
+    options.block_size  = block_size;
+
+    // keep the engine information of the first file
+    Header header {};
+    if (!inputs.empty())
+      header = FinReader {inputs.front()}.header;
+
+    BlockWriter writer {output_name, options, header};
+    if (!writer.is_open())
+      return EXIT_FAILURE;
+
+    // decompression of the inputs overlaps with the compression of the output
+    FinSource source {inputs};
+    const bool compressed = run_pipeline<vector<Position>>(
+      "compress",
+      [&](vector<Position>& positions) { return source.next(positions); },
+      [](vector<Position>&) {},
+      [&](vector<Position>& positions) {
+        writer.write(positions.data(), positions.size());
+        return !writer.failed;
+      },
+      true,
+      1);
+    if (!writer.close() || !compressed) {
+      cerr << "Could not write to " << output_name << endl;
+      return EXIT_FAILURE;
+    }
+
+    cout << "Successfully compressed " << inputs.size() << " file(s) into " << output_name << " ("
+         << writer.file_header.header.position_count << " pos, " << fs::file_size(output_name) << " bytes)" << endl;
+    return EXIT_SUCCESS;
+  }
+
+  /**
+   * Verify the integrity of fin files
+   */
+  else if (program.is_subcommand_used(verify_cmd)) {
+    auto decode = verify_cmd.get<bool>("--decode");
+    vector<string> inputs {};
+    if (!expand_manifests(verify_cmd.get<vector<string>>("files"), inputs))
+      return EXIT_FAILURE;
+
+    apply_threads_argument(verify_cmd);
+
+    size_t failed = 0;
+    for (const auto& input : inputs)
+      failed += !verify_file(input, decode);
+
+    if (failed > 0) {
+      cerr << failed << " of " << inputs.size() << " file(s) failed verification." << endl;
+      return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+  }
+
+  /**
+   * Filter positions
+   */
+  else if (program.is_subcommand_used(filter_cmd)) {
+    auto output_name = filter_cmd.get("--output");
+    vector<string> inputs {};
+    if (!expand_manifests(filter_cmd.get<vector<string>>("files"), inputs))
+      return EXIT_FAILURE;
+
+    PositionFilter filter {};
+    if (!parse_filter_arguments(filter_cmd, filter)) {
+      cerr << "Invalid wdl or side to move." << endl;
+      return EXIT_FAILURE;
+    }
+    if (fs::exists(output_name)) {
+      cerr << "Output file " << output_name << " already exists. Aborting to prevent accidental overwrite." << endl;
+      return EXIT_FAILURE;
+    }
+
+    apply_threads_argument(filter_cmd);
+
+    FinWriter writer {output_name};
+    if (!writer.is_open())
+      return EXIT_FAILURE;
+
+    FilterSummary summary = stream_filtered(
+      inputs,
+      filter,
+      [&](const vector<Position>& positions) {
+        for (const Position& p : positions)
+          writer.write(p);
+      },
+      [](const BlockStats&) {});
+    const bool written = writer.close();
+    summary.print();
+    if (summary.failed) {
+      cerr << "Could not read all input files." << endl;
+      return EXIT_FAILURE;
+    }
+    if (!written) {
+      cerr << "Could not write to " << output_name << endl;
+      return EXIT_FAILURE;
+    }
+
+    cout << "Successfully filtered " << inputs.size() << " file(s) into " << output_name << " ("
+         << writer.header.position_count << " pos)" << endl;
+    return EXIT_SUCCESS;
+  }
+
+  /**
+   * Summarise positions
+   */
+  else if (program.is_subcommand_used(stats_cmd)) {
+    vector<string> inputs {};
+    if (!expand_manifests(stats_cmd.get<vector<string>>("files"), inputs))
+      return EXIT_FAILURE;
+
+    PositionFilter filter {};
+    if (!parse_filter_arguments(stats_cmd, filter)) {
+      cerr << "Invalid wdl or side to move." << endl;
+      return EXIT_FAILURE;
+    }
+
+    apply_threads_argument(stats_cmd);
+
+    DatasetStats stats {};
+    if (!filtered_stats(inputs, filter, stats)) {
+      cerr << "Could not read all input files." << endl;
+      return EXIT_FAILURE;
+    }
+    cout << setw(14) << "Positions" << setw(12) << stats.count() << endl;
+    if (stats.count() == 0)
+      return EXIT_SUCCESS;
+    cout << setw(14) << "Pieces" << setw(12) << (int) stats.min_pieces << " - " << (int) stats.max_pieces << endl;
+    cout << setw(14) << "Score" << setw(12) << stats.min_score << " - " << stats.max_score << endl;
+    cout << setw(14) << "Loss/Draw/Win" << setw(12) << stats.wdl[0] << " / " << stats.wdl[1] << " / " << stats.wdl[2]
+         << endl;
+    cout << setw(14) << "White/Black" << setw(12) << stats.stm[0] << " / " << stats.stm[1] << endl;
+    return EXIT_SUCCESS;
+  }
+
+  /**
+   * Create a manifest
+   */
+  else if (program.is_subcommand_used(manifest_cmd)) {
+    auto output_name = manifest_cmd.get("--output");
+    auto inputs      = manifest_cmd.get<vector<string>>("files");
+
+    if (fs::exists(output_name)) {
+      cerr << "Output file " << output_name << " already exists. Aborting to prevent accidental overwrite." << endl;
+      return EXIT_FAILURE;
+    }
+
+    apply_threads_argument(manifest_cmd);
+
+    Manifest manifest {};
+    if (!Manifest::from_files(inputs, manifest) || !manifest.save(output_name))
+      return EXIT_FAILURE;
+
+    cout << "Successfully listed " << manifest.files.size() << " file(s) in " << output_name << " ("
+         << manifest.size() << " pos)" << endl;
+    return EXIT_SUCCESS;
+  }
+
+  /**
+   * Extract a range of positions
+   */
+  else if (program.is_subcommand_used(slice_cmd)) {
+    auto output_name = slice_cmd.get("--output");
+    auto inputs      = slice_cmd.get<vector<string>>("files");
+
+    if (fs::exists(output_name)) {
+      cerr << "Output file " << output_name << " already exists. Aborting to prevent accidental overwrite." << endl;
+      return EXIT_FAILURE;
+    }
+
+    if (is_block_file_name(output_name)) {
+      cerr << "Slices are raw fin files, compress them afterwards." << endl;
+      return EXIT_FAILURE;
+    }
+
+    apply_threads_argument(slice_cmd);
+
+    Manifest manifest {};
+    if (!Manifest::from_files(inputs, manifest))
+      return EXIT_FAILURE;
+
+    uint64_t end   = min(slice_cmd.get<uint64_t>("--end"), manifest.size());
+    uint64_t start = min(slice_cmd.get<uint64_t>("--start"), end);
+
+    if (!split_by_range(manifest, {output_name}, {1.0}, start, end - start)) {
+      cerr << "Failed to write " << output_name << endl;
+      return EXIT_FAILURE;
+    }
+
+    cout << "Successfully sliced " << manifest.files.size() << " file(s) into " << output_name << " ("
+         << end - start << " pos)" << endl;
+    return EXIT_SUCCESS;
+  }
+
+  /**
+   * Export dense planes
+   */
+  else if (program.is_subcommand_used(export_cmd)) {
+    auto prefix     = export_cmd.get("--output");
+    auto dtype      = export_cmd.get("--dtype");
+    auto shard_size = export_cmd.get<uint64_t>("--shard-size");
+    vector<string> inputs {};
+    if (!expand_manifests(export_cmd.get<vector<string>>("files"), inputs))
+      return EXIT_FAILURE;
+
+    if (dtype != "u8" && dtype != "f32") {
+      cerr << "Invalid dtype." << endl;
+      return EXIT_FAILURE;
+    }
+    if (fs::exists(PlaneShard::file_name(prefix, "planes", shard_size > 0 ? 0 : -1))) {
+      cerr << "Output files " << prefix << " already exist. Aborting to prevent accidental overwrite." << endl;
+      return EXIT_FAILURE;
+    }
+
+    apply_threads_argument(export_cmd);
+
+    if (!export_planes(inputs, prefix, dtype == "u8" ? PLANES_U8 : PLANES_F32, shard_size)) {
+      cerr << "Failed to write " << prefix << endl;
+      return EXIT_FAILURE;
+    }
+
+    cout << "Successfully exported " << inputs.size() << " file(s) to " << prefix << endl;
+    return EXIT_SUCCESS;
+  }
+
+  /**
+   * Augment positions
+   */
+  else if (program.is_subcommand_used(augment_cmd)) {
+    auto output_name = augment_cmd.get("--output");
+    auto transforms  = (augment_cmd.get<bool>("--mirror") ? AUGMENT_MIRROR : 0)
+                      | (augment_cmd.get<bool>("--flip") ? AUGMENT_FLIP : 0);
+    vector<string> inputs {};
+    if (!expand_manifests(augment_cmd.get<vector<string>>("files"), inputs))
+      return EXIT_FAILURE;
+
+    if (transforms == 0) {
+      cerr << "Select at least one of --mirror and --flip." << endl;
+      return EXIT_FAILURE;
+    }
+    if (fs::exists(output_name)) {
+      cerr << "Output file " << output_name << " already exists. Aborting to prevent accidental overwrite." << endl;
+      return EXIT_FAILURE;
+    }
+
+    apply_threads_argument(augment_cmd);
+
+    FinWriter writer {output_name};
+    if (!writer.is_open())
+      return EXIT_FAILURE;
+
+    struct AugmentBatch {
+      vector<Position> positions {};
+      vector<Position> augmented {};
+    };
+
+    FinSource source {inputs};
+    const bool augmented = run_pipeline<AugmentBatch>(
+      "augment",
+      [&](AugmentBatch& batch) { return source.next(batch.positions); },
+      [&](AugmentBatch& batch) {
+        batch.augmented.resize(batch.positions.size() * augment_variants(transforms));
+        augment_all(batch.positions.data(), batch.positions.size(), transforms, batch.augmented.data());
+      },
+      [&](AugmentBatch& batch) {
+        for (const Position& p : batch.augmented)
+          writer.write(p);
+        return !writer.failed;
+      },
+      true);
+    if (!writer.close() || !augmented) {
+      cerr << "Could not write to " << output_name << endl;
+      return EXIT_FAILURE;
+    }
+
+    cout << "Successfully augmented " << inputs.size() << " file(s) into " << output_name << " ("
+         << writer.header.position_count << " pos)" << endl;
+    return EXIT_SUCCESS;
+  }
 }
@@ -0,0 +1,257 @@
+#ifndef MANIFEST_H
+#define MANIFEST_H
+
+#include <algorithm>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "position.h"
+#include "reader.h"
+#include "threads.h"
+
+/**
+ * manifests describe a dataset spread across many fin files without copying them. A manifest is a
+ * text file listing one file per line together with its position count and the global index of its
+ * first position:
+ *
+ *    # fin manifest v1
+ *    <count> <start> <path>
+ *
+ * Relative paths are resolved against the directory of the manifest.
+ */
+#define MANIFEST_MAGIC      "# fin manifest v1"
+#define MANIFEST_EXTENSION  ".finm"
+#define MANIFEST_OPEN_FILES (64)
+
+struct Manifest {
+  std::vector<std::string> files {};
+  std::vector<uint64_t> counts {};
+  // prefix sums of the counts, starts[f] is the global index of the first position of file f
+  std::vector<uint64_t> starts {0};
+
+  uint64_t size() const {
+    return starts.back();
+  }
+
+  void add(const std::string& file, uint64_t count) {
+    files.push_back(file);
+    counts.push_back(count);
+    starts.push_back(starts.back() + count);
+  }
+
+  /**
+   * index of the file containing the position with the given global index.
+   */
+  size_t locate(uint64_t index) const {
+    return std::upper_bound(starts.begin(), starts.end(), index) - starts.begin() - 1;
+  }
+
+  /**
+   * returns true if the file starts with the manifest magic.
+   */
+  static bool is_manifest(const std::string& file) {
+    std::ifstream in(file);
+    std::string line {};
+    return std::getline(in, line) && line == MANIFEST_MAGIC;
+  }
+
+  /**
+   * loads the manifest from the given file.
+   * @return false if the file could not be read or is malformed
+   */
+  bool load(const std::string& file) {
+    std::ifstream in(file);
+    std::string line {};
+    if (!std::getline(in, line) || line != MANIFEST_MAGIC) {
+      std::cout << "not a manifest: " << file << std::endl;
+      return false;
+    }
+
+    const std::filesystem::path directory = std::filesystem::path(file).parent_path();
+    for (size_t number = 2; std::getline(in, line); number++) {
+      if (line.empty() || line[0] == '#')
+        continue;
+
+      std::istringstream fields(line);
+      uint64_t count {};
+      uint64_t start {};
+      std::string path {};
+      if (!(fields >> count >> start) || !std::getline(fields >> std::ws, path) || start != size()) {
+        std::cout << "malformed manifest " << file << " at line " << number << std::endl;
+        return false;
+      }
+      add(std::filesystem::path(path).is_absolute() ? path : (directory / path).string(), count);
+    }
+    return true;
+  }
+
+  /**
+   * writes the manifest with paths relative to its own directory.
+   * @return false if the file could not be written
+   */
+  bool save(const std::string& file) const {
+    std::ofstream out(file);
+    if (!out) {
+      std::cout << "could not open: " << file << std::endl;
+      return false;
+    }
+
+    const auto directory = std::filesystem::absolute(file).parent_path();
+    out << MANIFEST_MAGIC << "\n";
+    for (size_t f = 0; f < files.size(); f++)
+      out << counts[f] << " " << starts[f] << " "
+          << std::filesystem::proximate(std::filesystem::absolute(files[f]), directory).string() << "\n";
+    return (bool) out;
+  }
+
+  /**
+   * builds the manifest of the given files, reading their headers in parallel. Manifests among the
+   * files are expanded into the files they list.
+   * @param failed  receives the manifest or file which could not be loaded, if given
+   * @return false if a manifest is malformed or a file cannot be opened
+   */
+  static bool from_files(const std::vector<std::string>& files, Manifest& result, std::string* failed = nullptr) {
+    std::vector<std::string> expanded {};
+    std::vector<uint64_t> counts {};
+    std::vector<uint8_t> known {};
+
+    for (const auto& file : files) {
+      if (!is_manifest(file)) {
+        expanded.push_back(file);
+        counts.push_back(0);
+        known.push_back(false);
+        continue;
+      }
+      Manifest manifest {};
+      if (!manifest.load(file)) {
+        if (failed != nullptr)
+          *failed = file;
+        return false;
+      }
+      expanded.insert(expanded.end(), manifest.files.begin(), manifest.files.end());
+      counts.insert(counts.end(), manifest.counts.begin(), manifest.counts.end());
+      known.insert(known.end(), manifest.files.size(), true);
+    }
+
+    std::vector<uint8_t> opened(expanded.size(), true);
+    parallel_for(expanded.size(), [&](size_t begin, size_t end, int) {
+      for (size_t f = begin; f < end; f++) {
+        if (known[f])
+          continue;
+        FinReader reader {expanded[f]};
+        opened[f] = reader.is_open();
+        counts[f] = reader.is_open() ? reader.header.position_count : 0;
+      }
+    });
+
+    for (size_t f = 0; f < expanded.size(); f++) {
+      if (!opened[f]) {
+        std::cout << "could not open: " << expanded[f] << std::endl;
+        if (failed != nullptr)
+          *failed = expanded[f];
+        return false;
+      }
+    }
+
+    result = Manifest {};
+    for (size_t f = 0; f < expanded.size(); f++)
+      result.add(expanded[f], counts[f]);
+    return true;
+  }
+};
+
+/**
+ * replaces all manifests among the given files by the files they list.
+ * @return false if a manifest could not be loaded
+ */
+inline bool expand_manifests(const std::vector<std::string>& files, std::vector<std::string>& expanded) {
+  expanded.clear();
+  for (const auto& file : files) {
+    Manifest manifest {};
+    if (!Manifest::is_manifest(file)) {
+      expanded.push_back(file);
+      continue;
+    }
+    if (!manifest.load(file))
+      return false;
+    expanded.insert(expanded.end(), manifest.files.begin(), manifest.files.end());
+  }
+  return true;
+}
+
+/**
+ * random access reader over all positions of a manifest, addressed by their global index. Files
+ * are opened on demand and at most MANIFEST_OPEN_FILES are kept open at once. Not thread safe,
+ * use one reader per thread.
+ */
+struct ManifestReader {
+  Manifest manifest;
+  std::vector<std::unique_ptr<FinReader>> readers {};
+  // indices of the open files, least recently used first
+  std::vector<size_t> open_files {};
+
+  explicit ManifestReader(const Manifest& p_manifest) : manifest(p_manifest), readers(p_manifest.files.size()) {}
+
+  uint64_t size() const {
+    return manifest.size();
+  }
+
+  /**
+   * returns the reader of the given file, opening it if necessary.
+   * @return nullptr if the file cannot be opened or no longer matches the manifest
+   */
+  FinReader* reader(size_t f) {
+    auto it = std::find(open_files.begin(), open_files.end(), f);
+    if (it != open_files.end()) {
+      std::rotate(it, it + 1, open_files.end());
+      return readers[f].get();
+    }
+
+    auto reader = std::make_unique<FinReader>(manifest.files[f]);
+    if (!reader->is_open())
+      return nullptr;
+    if (reader->header.position_count != manifest.counts[f]) {
+      std::cout << "manifest is out of date: " << manifest.files[f] << " holds " << reader->header.position_count
+                << " instead of " << manifest.counts[f] << " position(s)" << std::endl;
+      return nullptr;
+    }
+
+    if (open_files.size() >= MANIFEST_OPEN_FILES) {
+      readers[open_files.front()].reset();
+      open_files.erase(open_files.begin());
+    }
+    open_files.push_back(f);
+    readers[f] = std::move(reader);
+    return readers[f].get();
+  }
+
+  /**
+   * reads count positions starting at the given global index, which may span multiple files.
+   * @return false if the range could not be read
+   */
+  bool read_at(uint64_t index, size_t count, Position* positions) {
+    if (index + count > size())
+      return false;
+
+    while (count > 0) {
+      size_t f       = manifest.locate(index);
+      uint64_t local = index - manifest.starts[f];
+      size_t n       = std::min<uint64_t>(count, manifest.counts[f] - local);
+      FinReader* r   = reader(f);
+      if (r == nullptr || !r->read_at(local, n, positions))
+        return false;
+      positions += n;
+      index += n;
+      count -= n;
+    }
+    return true;
+  }
+};
+
+#endif
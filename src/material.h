@@ -0,0 +1,91 @@
+#ifndef MATERIAL_H
+#define MATERIAL_H
+
+#include <algorithm>
+#include <string>
+
+#include "bitboard.h"
+#include "defs.h"
+#include "piece.h"
+#include "piecelist.h"
+#include "position.h"
+
+#define NIBBLE_ONES (0x1111111111111111ULL)
+
+/**
+ * maps a piece count onto one of the given amount of equally sized buckets.
+ */
+inline size_t piece_count_bucket(int piece_count, size_t buckets) {
+  return std::min<size_t>(buckets - 1, (size_t) piece_count * buckets / (MAX_PIECES_PER_BOARD + 1));
+}
+
+/**
+ * returns the range of piece counts which fall into the given bucket, e.g. 9-16.
+ */
+inline std::string piece_count_bucket_label(size_t bucket, size_t buckets) {
+  int first = MAX_PIECES_PER_BOARD;
+  int last  = 0;
+  for (int pieces = 0; pieces <= MAX_PIECES_PER_BOARD; pieces++) {
+    if (piece_count_bucket(pieces, buckets) == bucket) {
+      first = std::min(first, pieces);
+      last  = std::max(last, pieces);
+    }
+  }
+  return first == last ? std::to_string(first) : std::to_string(first) + "-" + std::to_string(last);
+}
+
+/**
+ * counts the nibbles among the lowest used nibbles of the bucket which equal the given piece.
+ * all nibbles are compared at once: the xor zeroes matching nibbles, which are then found by
+ * folding each nibble onto its lowest bit.
+ */
+inline int count_nibbles(BB bucket, Piece piece, int used) {
+  BB diff = bucket ^ (NIBBLE_ONES * (BB) piece);
+  diff |= diff >> 1;
+  diff |= diff >> 2;
+  BB valid = used >= PIECES_PER_BUCKET ? NIBBLE_ONES : NIBBLE_ONES & ((1ULL << (4 * used)) - 1);
+  return used - bit_count(diff & valid);
+}
+
+/**
+ * computes the material key of the position which stores the count of each of the 12 pieces
+ * in one nibble. Pieces are ordered by their piece index with 6 pieces per color.
+ */
+inline Key material_key(const Position& position) {
+  const int pieces = position.get_piece_count();
+  Key key          = 0;
+
+  for (int b = 0; b < MAX_BUCKETS; b++) {
+    int used = std::min(std::max(pieces - b * PIECES_PER_BUCKET, 0), PIECES_PER_BUCKET);
+    if (used == 0)
+      break;
+    BB bucket = position.m_pieces.m_piece_buckets[b];
+    for (Color c : {WHITE, BLACK})
+      for (PieceType pt = PAWN; pt <= KING; pt++)
+        key += (Key) count_nibbles(bucket, get_piece(c, pt), used) << (4 * (c * N_PIECE_TYPES + pt));
+  }
+  return key;
+}
+
+/**
+ * returns the count of the given piece stored in the material key.
+ */
+inline int material_count(Key key, Color color, PieceType piece_type) {
+  return (key >> (4 * (color * N_PIECE_TYPES + piece_type))) & mask<4>();
+}
+
+/**
+ * human readable signature of the material key, e.g. KRPPvKR.
+ */
+inline std::string material_string(Key key) {
+  std::string res {};
+  for (Color c : {WHITE, BLACK}) {
+    if (c == BLACK)
+      res += 'v';
+    for (PieceType pt : {KING, QUEEN, ROOK, BISHOP, KNIGHT, PAWN})
+      res += std::string(material_count(key, c, pt), piece_identifier[get_piece(WHITE, pt)]);
+  }
+  return res;
+}
+
+#endif
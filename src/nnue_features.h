@@ -0,0 +1,179 @@
+#ifndef NNUE_FEATURES_H
+#define NNUE_FEATURES_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "bitboard.h"
+#include "piece.h"
+#include "position.h"
+#include "square.h"
+#include "threads.h"
+
+/**
+ * sparse nnue input features. For each perspective, every piece on the board activates the feature
+ *
+ *    king_bucket * 768 + (own piece ? 0 : 6) * 64 + piece_type * 64 + square
+ *
+ * with the squares seen from the perspective, i.e. flipped vertically for black. Mirrored feature
+ * sets additionally flip the board horizontally whenever the king of the perspective stands on the
+ * files a to d, so the king always stands on the files e to h. A single king bucket yields the plain
+ * 768 piece square features, one bucket per king square yields HalfKA.
+ */
+#define FEATURES_PER_BUCKET (2 * N_PIECE_TYPES * N_SQUARES)
+
+struct FeatureSet {
+  // bucket of each king square, seen from the perspective and after mirroring
+  uint8_t king_buckets[N_SQUARES] {};
+  uint32_t bucket_count = 1;
+  bool mirrored         = false;
+
+  uint32_t input_size() const {
+    return bucket_count * FEATURES_PER_BUCKET;
+  }
+
+  /**
+   * parses one of the predefined feature sets: '768', '768-mirrored', 'halfka' and 'halfka-mirrored'.
+   * @return false if the name is unknown
+   */
+  bool parse(const std::string& name) {
+    mirrored     = name == "768-mirrored" || name == "halfka-mirrored";
+    bucket_count = 1;
+    for (Square sq = 0; sq < N_SQUARES; sq++)
+      king_buckets[sq] = 0;
+
+    if (name == "halfka") {
+      bucket_count = N_SQUARES;
+      for (Square sq = 0; sq < N_SQUARES; sq++)
+        king_buckets[sq] = sq;
+    } else if (name == "halfka-mirrored") {
+      // the king only stands on the files e to h
+      bucket_count = N_SQUARES / 2;
+      for (Square sq = 0; sq < N_SQUARES; sq++)
+        king_buckets[sq] = (sq / 8) * 4 + (sq % 8 >= 4 ? sq % 8 - 4 : 0);
+    }
+    return name == "768" || name == "768-mirrored" || name == "halfka" || name == "halfka-mirrored";
+  }
+
+  bool is_valid() const {
+    for (Square sq = 0; sq < N_SQUARES; sq++)
+      if (king_buckets[sq] >= bucket_count)
+        return false;
+    return bucket_count > 0;
+  }
+};
+
+/**
+ * writes the active features of the position from the perspective of the side to move and of the
+ * other side, one per piece on the board.
+ * @return the amount of features written per perspective, -1 without writing anything if the
+ *         position has more than MAX_PIECES_PER_BOARD pieces
+ */
+inline int extract_features(const Position& p, const FeatureSet& set, int32_t* stm, int32_t* nstm) {
+  if (p.get_piece_count() > MAX_PIECES_PER_BOARD)
+    return -1;
+
+  Square squares[MAX_PIECES_PER_BOARD];
+  Piece pieces[MAX_PIECES_PER_BOARD];
+  Square kings[N_COLORS] {};
+
+  // walk the occupancy and the piece nibbles in lockstep
+  BB occupancy = p.m_occupancy;
+  BB nibbles   = p.m_pieces.m_piece_buckets[0];
+  int count    = 0;
+  for (; occupancy; occupancy &= occupancy - 1, count++) {
+    if (count == PIECES_PER_BUCKET)
+      nibbles = p.m_pieces.m_piece_buckets[1];
+    squares[count] = __builtin_ctzll(occupancy);
+    pieces[count]  = nibbles & 0xF;
+    nibbles >>= 4;
+    if (get_piece_type(pieces[count]) == KING)
+      kings[get_piece_color(pieces[count])] = squares[count];
+  }
+
+  const Color us = p.m_meta.get_active_player();
+  for (Color perspective : {us, (Color) !us}) {
+    int32_t* out       = perspective == us ? stm : nstm;
+    Square orientation = perspective == WHITE ? 0 : 56;
+    if (set.mirrored && ((kings[perspective] ^ orientation) & 7) < 4)
+      orientation ^= 7;
+    const int32_t bucket = set.king_buckets[kings[perspective] ^ orientation] * FEATURES_PER_BUCKET;
+
+    for (int i = 0; i < count; i++) {
+      const int32_t side = get_piece_color(pieces[i]) == perspective ? 0 : N_PIECE_TYPES;
+      out[i] = bucket + (side + get_piece_type(pieces[i])) * N_SQUARES + (squares[i] ^ orientation);
+    }
+  }
+  return count;
+}
+
+/**
+ * features of a batch of positions in compressed sparse row format. The features of position i are
+ * stored in [offsets[i], offsets[i + 1]) of both index arrays.
+ */
+struct SparseFeatures {
+  std::vector<uint64_t> offsets {};
+  std::vector<int32_t> stm {};
+  std::vector<int32_t> nstm {};
+
+  /**
+   * row of each feature for the coordinate format.
+   */
+  std::vector<uint32_t> rows() const {
+    std::vector<uint32_t> res(stm.size());
+    for (size_t i = 0; i + 1 < offsets.size(); i++)
+      for (uint64_t f = offsets[i]; f < offsets[i + 1]; f++)
+        res[f] = i;
+    return res;
+  }
+};
+
+/**
+ * extracts the features of all positions in parallel into the caller provided arrays. The offsets
+ * need room for count + 1 entries, the index arrays for the total amount of pieces, which is at
+ * most MAX_PIECES_PER_BOARD per position. The work is split across the given amount of threads.
+ * @return false without writing anything if a position has more than MAX_PIECES_PER_BOARD pieces
+ */
+inline bool extract_features(const Position* positions,
+                             size_t count,
+                             const FeatureSet& set,
+                             uint64_t* offsets,
+                             int32_t* stm,
+                             int32_t* nstm,
+                             int threads = thread_count()) {
+  for (size_t i = 0; i < count; i++)
+    if (positions[i].get_piece_count() > MAX_PIECES_PER_BOARD)
+      return false;
+
+  offsets[0] = 0;
+  for (size_t i = 0; i < count; i++)
+    offsets[i + 1] = offsets[i] + positions[i].get_piece_count();
+
+  parallel_for(
+    count,
+    [&](size_t begin, size_t end, int) {
+      for (size_t i = begin; i < end; i++)
+        extract_features(positions[i], set, stm + offsets[i], nstm + offsets[i]);
+    },
+    threads);
+  return true;
+}
+
+/**
+ * @return the features of all positions, empty if a position has more than MAX_PIECES_PER_BOARD pieces
+ */
+inline SparseFeatures extract_features(const Position* positions, size_t count, const FeatureSet& set) {
+  SparseFeatures features {};
+  features.offsets.resize(count + 1);
+  uint64_t total = 0;
+  for (size_t i = 0; i < count; i++)
+    total += positions[i].get_piece_count();
+  features.stm.resize(total);
+  features.nstm.resize(total);
+  if (!extract_features(positions, count, set, features.offsets.data(), features.stm.data(), features.nstm.data()))
+    return SparseFeatures {};
+  return features;
+}
+
+#endif
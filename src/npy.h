@@ -0,0 +1,99 @@
+#ifndef NPY_H
+#define NPY_H
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+/**
+ * writer for numpy .npy arrays. The header is padded to NPY_HEADER_SIZE bytes so the data starts at
+ * a page boundary and chunks whose size is a multiple of the page size are written at aligned
+ * offsets. The shape of the first dimension is only known when closing, so the header is written
+ * last.
+ */
+#define NPY_HEADER_SIZE (4096)
+
+struct NpyWriter {
+  int fd = -1;
+  std::string descr {};
+  std::vector<size_t> item_shape {};
+  size_t item_size = 0;
+  uint64_t count   = 0;
+
+  /**
+   * opens an array of items with the given numpy type (e.g. '|u1', '<f4') and shape per item.
+   * @return false if the file could not be opened
+   */
+  bool open(const std::string& file, const std::string& p_descr, const std::vector<size_t>& p_shape, size_t p_size) {
+    fd = ::open(file.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+      std::cout << "could not open: " << file << std::endl;
+      return false;
+    }
+    descr      = p_descr;
+    item_shape = p_shape;
+    item_size  = p_size;
+    count      = 0;
+    return true;
+  }
+
+  bool is_open() const {
+    return fd >= 0;
+  }
+
+  /**
+   * appends n items.
+   */
+  bool write(const void* data, size_t n) {
+    const char* bytes = (const char*) data;
+    size_t size       = n * item_size;
+    off_t offset      = NPY_HEADER_SIZE + count * item_size;
+    while (size > 0) {
+      ssize_t written = pwrite(fd, bytes, size, offset);
+      if (written <= 0)
+        return false;
+      bytes += written;
+      offset += written;
+      size -= written;
+    }
+    count += n;
+    return true;
+  }
+
+  /**
+   * writes the header with the final amount of items and closes the file.
+   */
+  bool close() {
+    if (fd < 0)
+      return false;
+
+    std::string shape = "(" + std::to_string(count) + ",";
+    for (size_t s : item_shape)
+      shape += " " + std::to_string(s) + ",";
+    if (!item_shape.empty())
+      shape.pop_back();
+    shape += ")";
+
+    // magic, version 1.0 and the length of the python dict which fills the rest of the header
+    char header[NPY_HEADER_SIZE];
+    std::memset(header, ' ', sizeof(header));
+    std::memcpy(header, "\x93NUMPY\x01\x00", 8);
+    const uint16_t length = NPY_HEADER_SIZE - 10;
+    std::memcpy(header + 8, &length, sizeof(length));
+    std::string dict = "{'descr': '" + descr + "', 'fortran_order': False, 'shape': " + shape + ", }";
+    std::memcpy(header + 10, dict.data(), dict.size());
+    header[NPY_HEADER_SIZE - 1] = '\n';
+
+    bool success = pwrite(fd, header, sizeof(header), 0) == (ssize_t) sizeof(header);
+    success &= ::close(fd) == 0;
+    fd = -1;
+    return success;
+  }
+};
+
+#endif
@@ -0,0 +1,117 @@
+#ifndef PACKED_H
+#define PACKED_H
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include "bitboard.h"
+#include "position.h"
+
+/**
+ * compact encoding of a sequence of positions. Only the nibbles of the pieces which are actually
+ * on the board are stored, and the meta information and result are packed into 6 bytes.
+ * The positions are split into three streams so each of them compresses well on its own:
+ *
+ *    occupancy (8 bytes each) | meta + result (6 bytes each) | piece nibbles (ceil(pieces / 2) bytes each)
+ *
+ * The packed meta consists of the move count, the fifty move counter, the castling rights together
+ * with the active player and the wdl, the en passant square and the score.
+ */
+#define PACKED_META_SIZE     (6)
+#define PACKED_PADDING       (16)
+#define PACKED_MAX_SIZE(n)   ((n) * (sizeof(BB) + PACKED_META_SIZE + sizeof(PieceList)) + PACKED_PADDING)
+
+static_assert(MAX_BUCKETS == 2, "the packed encoding assumes two piece buckets");
+
+/**
+ * masks all but the lowest given amount of bytes of the value. Written such that the compiler
+ * emits a single bzhi when targeting bmi2.
+ */
+inline uint64_t keep_bytes(uint64_t value, int bytes) {
+  int bits = std::min(std::max(bytes * 8, 0), 64);
+  return bits == 64 ? value : value & ((1ULL << bits) - 1);
+}
+
+/**
+ * packs the meta information and the result of the position into PACKED_META_SIZE bytes.
+ */
+inline void pack_meta(const Position& p, uint8_t* m) {
+  m[0] = p.m_meta.m_move_count;
+  m[1] = p.m_meta.m_fifty_move_rule;
+  m[2] = (p.m_meta.m_castling_and_active_player & 0x8F) | ((p.m_result.wdl + 1) & 0x3) << 4;
+  m[3] = p.m_meta.m_en_passant_square;
+  std::memcpy(m + 4, &p.m_result.score, sizeof(int16_t));
+}
+
+/**
+ * restores the meta information and the result of the position from the packed bytes.
+ */
+inline void unpack_meta(const uint8_t* m, Position& p) {
+  p.m_meta.m_move_count                 = m[0];
+  p.m_meta.m_fifty_move_rule            = m[1];
+  p.m_meta.m_castling_and_active_player = m[2] & 0x8F;
+  p.m_meta.m_en_passant_square          = (Square) m[3];
+  p.m_result.wdl                        = (int8_t) ((m[2] >> 4) & 0x3) - 1;
+  std::memcpy(&p.m_result.score, m + 4, sizeof(int16_t));
+}
+
+/**
+ * encodes the positions into the output buffer.
+ */
+BMI2_CLONES inline void encode_packed(const Position* positions, size_t count, std::vector<uint8_t>& out) {
+  out.resize(PACKED_MAX_SIZE(count));
+
+  uint8_t* occupancy = out.data();
+  uint8_t* meta      = occupancy + count * sizeof(BB);
+  uint8_t* nibbles   = meta + count * PACKED_META_SIZE;
+
+  for (size_t i = 0; i < count; i++) {
+    const Position& p = positions[i];
+    std::memcpy(occupancy + i * sizeof(BB), &p.m_occupancy, sizeof(BB));
+
+    pack_meta(p, meta + i * PACKED_META_SIZE);
+
+    // always store both buckets and only advance by the bytes which are used
+    std::memcpy(nibbles, p.m_pieces.m_piece_buckets, sizeof(PieceList));
+    nibbles += (p.get_piece_count() + 1) / 2;
+  }
+  out.resize(nibbles - out.data());
+}
+
+/**
+ * decodes count positions from the buffer. The buffer must be readable for PACKED_PADDING bytes
+ * past its size.
+ * @return false if the size of the buffer does not match the encoded positions
+ */
+BMI2_CLONES inline bool decode_packed(const uint8_t* in, size_t size, Position* positions, size_t count) {
+  if (size < count * (sizeof(BB) + PACKED_META_SIZE))
+    return false;
+
+  const uint8_t* occupancy = in;
+  const uint8_t* meta      = occupancy + count * sizeof(BB);
+  const uint8_t* nibbles   = meta + count * PACKED_META_SIZE;
+  const uint8_t* end       = in + size;
+
+  for (size_t i = 0; i < count; i++) {
+    Position& p = positions[i];
+    p           = Position {};
+    std::memcpy(&p.m_occupancy, occupancy + i * sizeof(BB), sizeof(BB));
+
+    unpack_meta(meta + i * PACKED_META_SIZE, p);
+
+    // load both buckets at once and clear the bytes which belong to the next position
+    const int bytes = (p.get_piece_count() + 1) / 2;
+    if (nibbles + bytes > end)
+      return false;
+    uint64_t buckets[2];
+    std::memcpy(buckets, nibbles, sizeof(buckets));
+    p.m_pieces.m_piece_buckets[0] = keep_bytes(buckets[0], bytes);
+    p.m_pieces.m_piece_buckets[1] = keep_bytes(buckets[1], bytes - 8);
+    nibbles += bytes;
+  }
+  return nibbles == end;
+}
+
+#endif
@@ -0,0 +1,236 @@
+#ifndef PARTITION_H
+#define PARTITION_H
+
+#include <sys/resource.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <filesystem>
+#include <iomanip>
+#include <iostream>
+#include <list>
+#include <map>
+#include <memory>
+#include <regex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "material.h"
+#include "pipeline.h"
+#include "position.h"
+#include "reader.h"
+#include "writer.h"
+
+// smaller write buffers and a bounded amount of open files since there may be a lot of partitions
+#define PARTITION_BUFFER_SIZE    (1 << 12)
+#define PARTITION_MAX_OPEN_FILES (128)
+
+enum PartitionKey {
+  PIECE_COUNT,
+  MATERIAL
+};
+
+/**
+ * amount of outputs kept open at once, at most PARTITION_MAX_OPEN_FILES and half the limit of open
+ * files of the process.
+ */
+inline size_t partition_open_files() {
+  size_t open = PARTITION_MAX_OPEN_FILES;
+  struct rlimit limit {};
+  if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur != RLIM_INFINITY)
+    open = std::min<size_t>(open, limit.rlim_cur / 2);
+  return std::max<size_t>(open, 1);
+}
+
+/**
+ * one output of a partition. Block compressed outputs cannot be appended to, so their positions are
+ * spilled into a binary file first and compressed once all inputs are read.
+ */
+struct PartitionOutput {
+  std::string label;
+  std::string file_name;
+  std::string spill_name;
+  uint64_t count = 0;
+  bool created   = false;
+  std::unique_ptr<FinWriter> writer {};
+  std::list<size_t>::iterator lru {};
+};
+
+/**
+ * compresses the spilled positions of a block compressed output and removes the spill file.
+ * @return false if the output could not be written
+ */
+inline bool compress_spill(const PartitionOutput& output) {
+  bool success = true;
+  {
+    FinReader reader {output.spill_name};
+    FinWriter writer {output.file_name};
+    if (!reader.is_open() || !writer.is_open())
+      return false;
+    std::vector<Position> positions {};
+    while (reader.read(positions, 1 << 20) > 0)
+      for (const Position& p : positions)
+        writer.write(p);
+    success = writer.close() && writer.header.position_count == output.count;
+  }
+  std::remove(output.spill_name.c_str());
+  return success;
+}
+
+/**
+ * partitions the positions of the given files by their piece count or material signature.
+ * The output files will be generated using the out_format which is expected to contain at
+ * least one "$" (dollar sign), which is replaced with the label of the partition, e.g. 9-16
+ * or KRPvKR. Output files are only created for partitions which contain positions. Since
+ * there may be thousands of material signatures, only the most recently used outputs are
+ * kept open and the others are reopened for appending when needed. Existing files are never
+ * overwritten, the partition fails instead once it would create one.
+ * @param files         files to partition
+ * @param out_format    format of the output file names
+ * @param key_type      whether to partition by piece count or material signature
+ * @param buckets       amount of piece count buckets, 0 uses one bucket per piece count
+ * @return              false as soon as an output cannot be written
+ */
+inline bool partition(const std::vector<std::string>& files,
+                      const std::string& out_format,
+                      PartitionKey key_type,
+                      size_t buckets = 0) {
+  std::unordered_map<Key, uint32_t> indices {};
+  std::vector<PartitionOutput> outputs {};
+
+  // indices of the open outputs, most recently used first
+  std::list<size_t> open {};
+  const size_t max_open = partition_open_files();
+
+  auto acquire = [&](size_t o) -> FinWriter* {
+    PartitionOutput& output = outputs[o];
+    if (output.writer != nullptr) {
+      open.splice(open.begin(), open, output.lru);
+      return output.writer.get();
+    }
+    if (open.size() >= max_open) {
+      std::unique_ptr<FinWriter> evicted = std::move(outputs[open.back()].writer);
+      open.pop_back();
+      if (!evicted->close())
+        return nullptr;
+    }
+    // outputs are only known once their first position is seen, so they are checked when created
+    if (!output.created) {
+      for (const std::string& name : {output.file_name, output.spill_name}) {
+        if (std::filesystem::exists(name)) {
+          std::cout << "output already exists: " << name << std::endl;
+          return nullptr;
+        }
+      }
+    }
+    output.writer =
+      std::make_unique<FinWriter>(output.spill_name, PARTITION_BUFFER_SIZE, BlockOptions {}, output.created);
+    if (!output.writer->is_open()) {
+      output.writer.reset();
+      return nullptr;
+    }
+    output.created = true;
+    open.push_front(o);
+    output.lru = open.begin();
+    return output.writer.get();
+  };
+
+  // the workers compute the keys of each chunk, the sink assigns them to outputs in the order of the files
+  struct PartitionBatch {
+    std::vector<Position> positions {};
+    std::vector<Key> keys {};
+  };
+
+  std::vector<Position> grouped {};
+  std::vector<uint32_t> destinations {};
+  std::vector<size_t> starts {};
+
+  FinSource source {files};
+  const bool written = run_pipeline<PartitionBatch>(
+    "partition",
+    [&](PartitionBatch& batch) { return source.next(batch.positions); },
+    [&](PartitionBatch& batch) {
+      batch.keys.resize(batch.positions.size());
+      for (size_t i = 0; i < batch.positions.size(); i++) {
+        if (key_type == MATERIAL)
+          batch.keys[i] = material_key(batch.positions[i]);
+        else if (buckets == 0)
+          batch.keys[i] = batch.positions[i].get_piece_count();
+        else
+          batch.keys[i] = piece_count_bucket(batch.positions[i].get_piece_count(), buckets);
+      }
+    },
+    [&](PartitionBatch& batch) {
+      const std::vector<Position>& positions = batch.positions;
+      const std::vector<Key>& keys           = batch.keys;
+      destinations.resize(positions.size());
+
+      // map the keys onto outputs, the files of new outputs are created when first written
+      for (size_t i = 0; i < positions.size(); i++) {
+        auto it = indices.find(keys[i]);
+        if (it == indices.end()) {
+          PartitionOutput output {};
+          output.label = key_type == MATERIAL ? material_string(keys[i])
+                         : buckets == 0       ? std::to_string(keys[i])
+                                              : piece_count_bucket_label(keys[i], buckets);
+          output.file_name  = std::regex_replace(out_format, std::regex("\\$"), output.label);
+          output.spill_name = is_block_file_name(output.file_name) ? output.file_name + ".tmp" : output.file_name;
+          outputs.push_back(std::move(output));
+          it = indices.emplace(keys[i], outputs.size() - 1).first;
+        }
+        destinations[i] = it->second;
+      }
+
+      // write the positions of each output at once, so each chunk opens every output at most once
+      group_by_destination(positions, destinations, outputs.size(), grouped, starts);
+      for (size_t o = 0; o < outputs.size(); o++) {
+        if (starts[o] == starts[o + 1])
+          continue;
+        FinWriter* writer = acquire(o);
+        if (writer == nullptr)
+          return false;
+        for (size_t i = starts[o]; i < starts[o + 1]; i++)
+          writer->write(grouped[i]);
+        outputs[o].count += starts[o + 1] - starts[o];
+        if (writer->failed)
+          return false;
+      }
+      return true;
+    },
+    true);
+
+  bool closed = true;
+  for (auto& output : outputs) {
+    if (output.writer != nullptr)
+      closed &= output.writer->close();
+    output.writer.reset();
+  }
+  if (!written || !closed) {
+    // only the spills created by this run are removed, existing files were refused above
+    for (const auto& output : outputs)
+      if (output.created && output.spill_name != output.file_name)
+        std::remove(output.spill_name.c_str());
+    return false;
+  }
+  for (const auto& output : outputs)
+    if (output.spill_name != output.file_name && !compress_spill(output))
+      return false;
+
+  std::vector<size_t> order(outputs.size());
+  for (size_t i = 0; i < order.size(); i++)
+    order[i] = i;
+  std::sort(order.begin(), order.end(), [&](size_t a, size_t b) { return outputs[a].count > outputs[b].count; });
+
+  size_t width = 8;
+  for (const auto& output : outputs)
+    width = std::max(width, output.label.size() + 2);
+
+  std::cout << std::setw(width) << "Bucket" << std::setw(14) << "Positions" << std::endl;
+  for (size_t i : order)
+    std::cout << std::setw(width) << outputs[i].label << std::setw(14) << outputs[i].count << std::endl;
+
+  return true;
+}
+
+#endif
@@ -7,6 +7,9 @@
 #define PIECES_PER_BUCKET    (64 / 4)
 #define MAX_BUCKETS          (MAX_PIECES_PER_BOARD / PIECES_PER_BUCKET)
 
+// all nibbles of a piece list, the first piece in the lowest nibble
+typedef unsigned __int128 NibbleList;
+
 /**
  * container storing the pieces on the board
  */
@@ -38,4 +41,13 @@ struct PieceList {
   }
 };
 
+inline NibbleList load_nibbles(const PieceList& pieces) {
+  return (NibbleList) pieces.m_piece_buckets[1] << 64 | pieces.m_piece_buckets[0];
+}
+
+inline void store_nibbles(PieceList& pieces, NibbleList nibbles) {
+  pieces.m_piece_buckets[0] = (BB) nibbles;
+  pieces.m_piece_buckets[1] = (BB) (nibbles >> 64);
+}
+
 #endif
@@ -0,0 +1,274 @@
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "progress.h"
+#include "threads.h"
+
+/**
+ * staged pipelines of batches. A source fills batches on its own thread, worker threads transform
+ * them and the calling thread hands them to a sink, either in the order of the source or in the order
+ * they are finished. The stages are connected by bounded lock-free queues. A fixed set of batches
+ * circulates through the pipeline and is recycled once the sink is done with it, so the buffers of a
+ * batch keep their capacity, the memory in flight is bounded and the source blocks whenever the
+ * workers or the sink fall behind. Passes which move ranges of positions without looking at them,
+ * like combine, slice, sample and split into ranges, copy them with positional reads and writes or
+ * in the kernel instead.
+ */
+
+/**
+ * bounded multi producer multi consumer ring buffer. Each cell carries a sequence number which tells
+ * whether it is ready to be written or read in the current lap, so producers and consumers only
+ * contend on the head or the tail. Single producer or single consumer links use the same queue.
+ * Blocking calls spin briefly, then yield and finally sleep, since the batches are coarse.
+ */
+template<typename T>
+struct BoundedQueue {
+  struct Cell {
+    std::atomic<size_t> sequence {0};
+    T value {};
+  };
+
+  std::unique_ptr<Cell[]> cells {};
+  size_t mask = 0;
+
+  alignas(64) std::atomic<size_t> head {0};
+  alignas(64) std::atomic<size_t> tail {0};
+  std::atomic<bool> closed {false};
+
+  explicit BoundedQueue(size_t capacity) {
+    size_t size = 2;
+    while (size < capacity)
+      size *= 2;
+    cells = std::make_unique<Cell[]>(size);
+    mask  = size - 1;
+    for (size_t i = 0; i < size; i++)
+      cells[i].sequence.store(i, std::memory_order_relaxed);
+  }
+
+  BoundedQueue(const BoundedQueue&)            = delete;
+  BoundedQueue& operator=(const BoundedQueue&) = delete;
+
+  static void backoff(int spins) {
+    if (spins < 64)
+      return;
+    if (spins < 128)
+      std::this_thread::yield();
+    else
+      std::this_thread::sleep_for(std::chrono::microseconds(50));
+  }
+
+  /**
+   * @return false if the queue is full, in which case the value is left untouched
+   */
+  bool try_push(T& value) {
+    size_t pos = tail.load(std::memory_order_relaxed);
+    while (true) {
+      Cell& cell           = cells[pos & mask];
+      const size_t seq     = cell.sequence.load(std::memory_order_acquire);
+      const intptr_t delta = (intptr_t) seq - (intptr_t) pos;
+      if (delta == 0) {
+        if (tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+          cell.value = std::move(value);
+          cell.sequence.store(pos + 1, std::memory_order_release);
+          return true;
+        }
+      } else if (delta < 0) {
+        return false;
+      } else {
+        pos = tail.load(std::memory_order_relaxed);
+      }
+    }
+  }
+
+  /**
+   * @return false if the queue is empty
+   */
+  bool try_pop(T& value) {
+    size_t pos = head.load(std::memory_order_relaxed);
+    while (true) {
+      Cell& cell           = cells[pos & mask];
+      const size_t seq     = cell.sequence.load(std::memory_order_acquire);
+      const intptr_t delta = (intptr_t) seq - (intptr_t) (pos + 1);
+      if (delta == 0) {
+        if (head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+          value = std::move(cell.value);
+          cell.sequence.store(pos + mask + 1, std::memory_order_release);
+          return true;
+        }
+      } else if (delta < 0) {
+        return false;
+      } else {
+        pos = head.load(std::memory_order_relaxed);
+      }
+    }
+  }
+
+  /**
+   * waits until there is room for the value.
+   */
+  void push(T value) {
+    for (int spins = 0; !try_push(value); spins++)
+      backoff(spins);
+  }
+
+  /**
+   * waits for the next value.
+   * @return false once the queue is closed and empty
+   */
+  bool pop(T& value) {
+    for (int spins = 0;; spins++) {
+      if (try_pop(value))
+        return true;
+      // everything pushed before closing is visible once the close is
+      if (closed.load(std::memory_order_acquire))
+        return try_pop(value);
+      backoff(spins);
+    }
+  }
+
+  /**
+   * marks the end of the values. Must only be called once all producers are done.
+   */
+  void close() {
+    closed.store(true, std::memory_order_release);
+  }
+
+  /**
+   * approximate amount of queued values.
+   */
+  size_t size() const {
+    const size_t t = tail.load(std::memory_order_relaxed);
+    const size_t h = head.load(std::memory_order_relaxed);
+    return t > h ? t - h : 0;
+  }
+};
+
+template<typename Batch>
+struct PipelineSlot {
+  uint64_t sequence = 0;
+  Batch batch {};
+};
+
+/**
+ * runs source(batch) until it returns false, transform(batch) on the given amount of worker threads
+ * and sink(batch) on the calling thread. The source refills recycled batches, so it must overwrite
+ * everything the later stages read. If ordered is set, the sink receives the batches in the order of
+ * the source. At most depth batches are in flight, by default two per worker and two more for the
+ * source and the sink. If the sink returns false, the source is stopped and the remaining batches are
+ * dropped. The time each stage spends working and waiting is counted under <name>.source,
+ * <name>.transform and <name>.sink.
+ * @return false if the sink failed
+ */
+template<typename Batch, typename S, typename T, typename K>
+inline bool run_pipeline(const std::string& name,
+                         S&& source,
+                         T&& transform,
+                         K&& sink,
+                         bool ordered,
+                         int workers  = thread_count(),
+                         size_t depth = 0) {
+  using Slot = PipelineSlot<Batch>;
+
+  workers = std::max(1, workers);
+  depth   = depth > 0 ? depth : 2 * workers + 2;
+
+  // every queue can hold all batches, so only taking a free batch ever blocks the source
+  std::vector<Slot> slots(depth);
+  BoundedQueue<Slot*> free_slots {depth};
+  BoundedQueue<Slot*> work {depth};
+  BoundedQueue<Slot*> done {depth};
+  for (Slot& slot : slots)
+    free_slots.push(&slot);
+
+  // the source stalls on backpressure, the workers and the sink stall on an empty queue
+  StageCounters& source_stage    = progress_stage(name + ".source");
+  StageCounters& transform_stage = progress_stage(name + ".transform");
+  StageCounters& sink_stage      = progress_stage(name + ".sink");
+
+  std::atomic<bool> stopped {false};
+  std::thread producer([&]() {
+    Slot* slot        = nullptr;
+    uint64_t sequence = 0;
+    uint64_t time     = progress_clock();
+    while (!stopped && free_slots.pop(slot) && !stopped) {
+      time = source_stage.stall(time);
+      if (!source(slot->batch))
+        break;
+      time           = source_stage.busy(time);
+      slot->sequence = sequence++;
+      work.push(slot);
+      source_stage.add(0, 0);
+      transform_stage.queued.store(work.size(), std::memory_order_relaxed);
+    }
+    work.close();
+  });
+
+  std::atomic<int> running {workers};
+  std::vector<std::thread> threads {};
+  for (int w = 0; w < workers; w++) {
+    threads.emplace_back([&]() {
+      Slot* slot    = nullptr;
+      uint64_t time = progress_clock();
+      while (work.pop(slot)) {
+        time = transform_stage.stall(time);
+        transform_stage.queued.store(work.size(), std::memory_order_relaxed);
+        if (!stopped)
+          transform(slot->batch);
+        time = transform_stage.busy(time);
+        done.push(slot);
+        transform_stage.add(0, 0);
+        sink_stage.queued.store(done.size(), std::memory_order_relaxed);
+      }
+      if (--running == 0)
+        done.close();
+    });
+  }
+
+  bool success  = true;
+  uint64_t time = progress_clock();
+  auto consume  = [&](Slot* slot) {
+    time = sink_stage.stall(time);
+    sink_stage.queued.store(done.size(), std::memory_order_relaxed);
+    if (success && !sink(slot->batch)) {
+      success = false;
+      stopped = true;
+    }
+    time = sink_stage.busy(time);
+    sink_stage.add(0, 0);
+    free_slots.push(slot);
+  };
+
+  // out of order batches wait in the slot given by their sequence, which is unique among the batches
+  // in flight
+  std::vector<Slot*> waiting(depth, nullptr);
+  uint64_t next = 0;
+  Slot* slot    = nullptr;
+  while (done.pop(slot)) {
+    if (!ordered) {
+      consume(slot);
+      continue;
+    }
+    waiting[slot->sequence % depth] = slot;
+    while (waiting[next % depth] != nullptr) {
+      Slot* ready             = waiting[next % depth];
+      waiting[next++ % depth] = nullptr;
+      consume(ready);
+    }
+  }
+
+  producer.join();
+  for (auto& thread : threads)
+    thread.join();
+  return success;
+}
+
+#endif
@@ -0,0 +1,250 @@
+#ifndef PLANES_H
+#define PLANES_H
+
+#include <cstdint>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+#include "bitboard.h"
+#include "mailbox.h"
+#include "npy.h"
+#include "pipeline.h"
+#include "piece.h"
+#include "position.h"
+#include "reader.h"
+#include "threads.h"
+
+/**
+ * dense input planes. Each position is expanded into one plane of 64 squares per piece, white pawn
+ * to white king followed by black pawn to black king, with squares ordered a1, b1, ..., h8. A square
+ * holds 1 if the piece of the plane stands on it and 0 otherwise. The bits of each bitboard are
+ * expanded into bytes using pdep if the cpu supports fast bmi2, otherwise using a table of 8 byte
+ * words.
+ */
+#define PLANE_COUNT       (2 * N_PIECE_TYPES)
+#define PLANES_SIZE       (PLANE_COUNT * N_SQUARES)
+#define EXPORT_CHUNK_SIZE (1 << 14)
+
+enum PlaneType {
+  PLANES_U8,
+  PLANES_F32
+};
+
+struct BitExpansionTable {
+  uint64_t bytes[256];
+
+  BitExpansionTable() {
+    for (int b = 0; b < 256; b++) {
+      bytes[b] = 0;
+      for (int j = 0; j < 8; j++)
+        bytes[b] |= (uint64_t) ((b >> j) & 1) << (8 * j);
+    }
+  }
+};
+
+inline void expand_planes_software(const Position* positions, size_t count, uint8_t* out) {
+  static const BitExpansionTable t {};
+
+  BB bitboards[16];
+  for (size_t i = 0; i < count; i++) {
+    piece_bitboards(positions[i], bitboards);
+    for (Color c : {WHITE, BLACK}) {
+      for (PieceType pt = PAWN; pt <= KING; pt++, out += N_SQUARES) {
+        const BB bb = bitboards[get_piece(c, pt)];
+        for (int r = 0; r < 8; r++)
+          std::memcpy(out + 8 * r, &t.bytes[(bb >> (8 * r)) & 0xFF], sizeof(uint64_t));
+      }
+    }
+  }
+}
+
+#if defined(__x86_64__)
+__attribute__((target("bmi2"))) inline void expand_planes_bmi2(const Position* positions, size_t count, uint8_t* out) {
+  BB bitboards[16];
+  for (size_t i = 0; i < count; i++) {
+    piece_bitboards(positions[i], bitboards);
+    for (Color c : {WHITE, BLACK}) {
+      for (PieceType pt = PAWN; pt <= KING; pt++, out += N_SQUARES) {
+        const BB bb = bitboards[get_piece(c, pt)];
+        for (int r = 0; r < 8; r++) {
+          const uint64_t bytes = _pdep_u64(bb >> (8 * r), 0x0101010101010101ULL);
+          std::memcpy(out + 8 * r, &bytes, sizeof(uint64_t));
+        }
+      }
+    }
+  }
+}
+#endif
+
+/**
+ * expands count positions into PLANES_SIZE bytes each, without splitting the work across threads.
+ */
+inline void expand_planes_serial(const Position* positions, size_t count, uint8_t* out) {
+#if defined(__x86_64__)
+  if (has_fast_bmi2()) {
+    expand_planes_bmi2(positions, count, out);
+    return;
+  }
+#endif
+  expand_planes_software(positions, count, out);
+}
+
+/**
+ * expands count positions into PLANES_SIZE floats each, without splitting the work across threads.
+ */
+inline void expand_planes_serial(const Position* positions, size_t count, float* out) {
+  constexpr size_t STEP = 16;
+
+  uint8_t bytes[STEP * PLANES_SIZE];
+  for (size_t i = 0; i < count; i += STEP) {
+    const size_t n = std::min(STEP, count - i);
+    expand_planes_serial(positions + i, n, bytes);
+    for (size_t k = 0; k < n * PLANES_SIZE; k++)
+      out[i * PLANES_SIZE + k] = bytes[k];
+  }
+}
+
+/**
+ * expands the positions into PLANES_SIZE bytes each in parallel on the given amount of threads.
+ */
+inline void expand_planes(const Position* positions, size_t count, uint8_t* out, int threads = thread_count()) {
+  parallel_for(
+    count,
+    [&](size_t begin, size_t end, int) {
+      expand_planes_serial(positions + begin, end - begin, out + begin * PLANES_SIZE);
+    },
+    threads);
+}
+
+/**
+ * expands the positions into PLANES_SIZE floats each in parallel on the given amount of threads.
+ */
+inline void expand_planes(const Position* positions, size_t count, float* out, int threads = thread_count()) {
+  parallel_for(
+    count,
+    [&](size_t begin, size_t end, int) {
+      expand_planes_serial(positions + begin, end - begin, out + begin * PLANES_SIZE);
+    },
+    threads);
+}
+
+/**
+ * copies the score and the result of each position. Either output may be null.
+ */
+inline void extract_targets(const Position* positions, size_t count, int16_t* score, int8_t* wdl) {
+  for (size_t i = 0; i < count; i++) {
+    if (score != nullptr)
+      score[i] = positions[i].m_result.score;
+    if (wdl != nullptr)
+      wdl[i] = positions[i].m_result.wdl;
+  }
+}
+
+/**
+ * the three arrays of one output shard: the planes, the scores and the results.
+ */
+struct PlaneShard {
+  NpyWriter planes {};
+  NpyWriter score {};
+  NpyWriter wdl {};
+
+  static std::string file_name(const std::string& prefix, const std::string& array, int64_t index) {
+    std::stringstream ss {};
+    ss << prefix << "_" << array;
+    if (index >= 0)
+      ss << "_" << std::setw(5) << std::setfill('0') << index;
+    ss << ".npy";
+    return ss.str();
+  }
+
+  bool open(const std::string& prefix, int64_t index, PlaneType type) {
+    return planes.open(file_name(prefix, "planes", index),
+                       type == PLANES_U8 ? "|u1" : "<f4",
+                       {PLANE_COUNT, N_SQUARES},
+                       PLANES_SIZE * (type == PLANES_U8 ? sizeof(uint8_t) : sizeof(float)))
+           && score.open(file_name(prefix, "score", index), "<i2", {}, sizeof(int16_t))
+           && wdl.open(file_name(prefix, "wdl", index), "|i1", {}, sizeof(int8_t));
+  }
+
+  bool close() {
+    bool success = planes.close();
+    success &= score.close();
+    success &= wdl.close();
+    return success;
+  }
+};
+
+/**
+ * writes the planes, scores and results of all positions into .npy files named
+ * <prefix>_<array>.npy, or <prefix>_<array>_<shard>.npy with shard_size positions per shard if
+ * shard_size is not 0.
+ * @return false if any of the outputs could not be written
+ */
+inline bool export_planes(const std::vector<std::string>& files,
+                          const std::string& prefix,
+                          PlaneType type,
+                          uint64_t shard_size) {
+  struct PlaneBatch {
+    std::vector<Position> positions {};
+    std::vector<uint8_t> planes {};
+    std::vector<int16_t> score {};
+    std::vector<int8_t> wdl {};
+  };
+
+  const size_t plane_bytes = PLANES_SIZE * (type == PLANES_U8 ? sizeof(uint8_t) : sizeof(float));
+
+  PlaneShard shard {};
+  int64_t shard_index = -1;
+  bool success        = true;
+
+  // the workers expand the chunks, the sink cuts them into shards in the order of the inputs
+  FinSource source {files, EXPORT_CHUNK_SIZE};
+  run_pipeline<PlaneBatch>(
+    "export",
+    [&](PlaneBatch& batch) { return source.next(batch.positions); },
+    [&](PlaneBatch& batch) {
+      const size_t count = batch.positions.size();
+      batch.planes.resize(count * plane_bytes);
+      batch.score.resize(count);
+      batch.wdl.resize(count);
+      if (type == PLANES_U8)
+        expand_planes_serial(batch.positions.data(), count, batch.planes.data());
+      else
+        expand_planes_serial(batch.positions.data(), count, (float*) batch.planes.data());
+      extract_targets(batch.positions.data(), count, batch.score.data(), batch.wdl.data());
+    },
+    [&](PlaneBatch& batch) {
+      const size_t count = batch.positions.size();
+      for (size_t first = 0; first < count;) {
+        if (shard_index < 0 || (shard_size > 0 && shard.planes.count == shard_size)) {
+          if (shard_index >= 0)
+            success &= shard.close();
+          shard_index++;
+          if (!shard.open(prefix, shard_size > 0 ? shard_index : -1, type))
+            return success = false;
+        }
+        size_t n = count - first;
+        if (shard_size > 0)
+          n = std::min<uint64_t>(n, shard_size - shard.planes.count);
+        success &= shard.planes.write(batch.planes.data() + first * plane_bytes, n)
+                   && shard.score.write(batch.score.data() + first, n) && shard.wdl.write(batch.wdl.data() + first, n);
+        first += n;
+      }
+      return success;
+    },
+    true);
+
+  if (shard_index >= 0)
+    success &= shard.close();
+  return success;
+}
+
+#endif
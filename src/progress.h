@@ -0,0 +1,282 @@
+#ifndef PROGRESS_H
+#define PROGRESS_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+
+/**
+ * throughput instrumentation. Each stage of the work, e.g. reading, writing or a stage of a pipeline,
+ * owns a set of counters which the hot loops bump once per chunk or batch using relaxed atomics. A
+ * reporting thread samples all counters periodically and prints the rates since the previous report,
+ * either as a line of text on stdout or as one json object per line on stderr, so the regular output
+ * and the progress can be consumed separately. The last report summarises the whole run.
+ */
+enum ProgressMode {
+  PROGRESS_NONE,
+  PROGRESS_TEXT,
+  PROGRESS_JSON
+};
+
+/**
+ * monotonic time in nanoseconds.
+ */
+inline uint64_t progress_clock() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch())
+    .count();
+}
+
+struct StageCounters {
+  std::string name;
+  std::atomic<uint64_t> positions {0};
+  std::atomic<uint64_t> bytes {0};
+  std::atomic<uint64_t> batches {0};
+  std::atomic<uint64_t> busy_ns {0};
+  std::atomic<uint64_t> stall_ns {0};
+  // amount of batches waiting in front of the stage, -1 if it has no queue
+  std::atomic<int64_t> queued {-1};
+
+  // values at the previous report, only touched by the reporter
+  uint64_t last_positions = 0;
+  uint64_t last_bytes     = 0;
+  uint64_t last_batches   = 0;
+
+  explicit StageCounters(const std::string& p_name) : name(p_name) {}
+
+  /**
+   * counts one chunk of the given amount of positions and bytes.
+   */
+  void add(uint64_t p_positions, uint64_t p_bytes) {
+    positions.fetch_add(p_positions, std::memory_order_relaxed);
+    bytes.fetch_add(p_bytes, std::memory_order_relaxed);
+    batches.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  /**
+   * adds the time from start until now to the busy or the stalled time and returns now.
+   */
+  uint64_t busy(uint64_t start) {
+    const uint64_t now = progress_clock();
+    busy_ns.fetch_add(now - start, std::memory_order_relaxed);
+    return now;
+  }
+
+  uint64_t stall(uint64_t start) {
+    const uint64_t now = progress_clock();
+    stall_ns.fetch_add(now - start, std::memory_order_relaxed);
+    return now;
+  }
+};
+
+struct Progress {
+  std::mutex mutex {};
+  std::deque<StageCounters> stages {};
+
+  ProgressMode mode = PROGRESS_NONE;
+  double interval   = 1.0;
+  uint64_t start    = progress_clock();
+  uint64_t last     = start;
+
+  std::thread thread {};
+  std::condition_variable wake {};
+  bool stop = false;
+
+  Progress() = default;
+
+  Progress(const Progress&)            = delete;
+  Progress& operator=(const Progress&) = delete;
+
+  ~Progress() {
+    finish();
+  }
+
+  /**
+   * returns the counters of the stage with the given name, creating them on first use. The reference
+   * stays valid for the lifetime of the program, so callers look it up once.
+   */
+  StageCounters& stage(const std::string& name) {
+    std::lock_guard<std::mutex> lock {mutex};
+    for (auto& s : stages)
+      if (s.name == name)
+        return s;
+    return stages.emplace_back(name);
+  }
+
+  /**
+   * starts reporting every interval seconds in the given mode.
+   */
+  void begin(ProgressMode p_mode, double p_interval) {
+    mode     = p_mode;
+    interval = p_interval;
+    start    = progress_clock();
+    last     = start;
+    if (mode == PROGRESS_NONE)
+      return;
+
+    thread = std::thread([this]() {
+      std::unique_lock<std::mutex> lock {mutex};
+      const auto period = std::chrono::duration<double>(interval);
+      while (!wake.wait_for(lock, period, [this]() { return stop; }))
+        report(false);
+    });
+  }
+
+  /**
+   * stops the reporting thread and prints the summary of the whole run.
+   */
+  void finish() {
+    if (!thread.joinable())
+      return;
+    {
+      std::lock_guard<std::mutex> lock {mutex};
+      stop = true;
+    }
+    wake.notify_all();
+    thread.join();
+
+    std::lock_guard<std::mutex> lock {mutex};
+    report(true);
+  }
+
+  static void print_json_string(FILE* f, const std::string& s) {
+    fputc('"', f);
+    for (char c : s) {
+      if (c == '"' || c == '\\')
+        fputc('\\', f);
+      fputc(c, f);
+    }
+    fputc('"', f);
+  }
+
+  /**
+   * prints the counters with the rates since the previous report, or since the start for the final
+   * report. Expects the mutex to be held.
+   */
+  void report(bool final) {
+    const uint64_t now   = progress_clock();
+    const double elapsed = (now - start) * 1e-9;
+    const double seconds = std::max(1e-9, (now - (final ? start : last)) * 1e-9);
+    last                 = now;
+
+    bool first = true;
+
+    if (mode == PROGRESS_JSON)
+      fprintf(stderr, "{\"elapsed\": %.3f, \"final\": %s, \"stages\": [", elapsed, final ? "true" : "false");
+
+    for (auto& s : stages) {
+      const uint64_t positions = s.positions.load(std::memory_order_relaxed);
+      const uint64_t bytes     = s.bytes.load(std::memory_order_relaxed);
+      const uint64_t batches   = s.batches.load(std::memory_order_relaxed);
+      const double busy        = s.busy_ns.load(std::memory_order_relaxed) * 1e-9;
+      const double stall       = s.stall_ns.load(std::memory_order_relaxed) * 1e-9;
+      const int64_t queued     = s.queued.load(std::memory_order_relaxed);
+
+      const double position_rate = (positions - (final ? 0 : s.last_positions)) / seconds;
+      const double byte_rate     = (bytes - (final ? 0 : s.last_bytes)) / seconds;
+      const bool changed         = batches != s.last_batches;
+      s.last_positions           = positions;
+      s.last_bytes               = bytes;
+      s.last_batches             = batches;
+
+      if (mode == PROGRESS_JSON) {
+        fprintf(stderr, first ? "{\"name\": " : ", {\"name\": ");
+        print_json_string(stderr, s.name);
+        fprintf(stderr,
+                ", \"positions\": %llu, \"bytes\": %llu, \"batches\": %llu, \"positions_per_s\": %.1f, "
+                "\"bytes_per_s\": %.1f, \"busy_s\": %.3f, \"stall_s\": %.3f",
+                (unsigned long long) positions,
+                (unsigned long long) bytes,
+                (unsigned long long) batches,
+                position_rate,
+                byte_rate,
+                busy,
+                stall);
+        if (queued >= 0)
+          fprintf(stderr, ", \"queued\": %lld", (long long) queued);
+        fprintf(stderr, "}");
+      } else if (mode == PROGRESS_TEXT && (changed || final) && batches > 0) {
+        if (first)
+          printf("[%.0fs] ", elapsed);
+        else
+          printf(" | ");
+        printf("%s: %llu batch(es)", s.name.c_str(), (unsigned long long) batches);
+        if (positions > 0)
+          printf(", %llu pos, %.0f pos/s, %.1f MB/s",
+                 (unsigned long long) positions,
+                 position_rate,
+                 byte_rate / (1 << 20));
+        if (busy > 0 || stall > 0)
+          printf(", busy %.1fs, stalled %.1fs", busy, stall);
+        if (queued >= 0)
+          printf(", %lld queued", (long long) queued);
+      } else {
+        continue;
+      }
+      first = false;
+    }
+
+    if (mode == PROGRESS_JSON) {
+      fprintf(stderr, "]}\n");
+      fflush(stderr);
+    } else if (!first) {
+      printf("\n");
+      fflush(stdout);
+    }
+  }
+};
+
+/**
+ * returns the counters of all stages.
+ */
+inline Progress& progress() {
+  static Progress p {};
+  return p;
+}
+
+/**
+ * returns the counters of the stage with the given name.
+ */
+inline StageCounters& progress_stage(const std::string& name) {
+  return progress().stage(name);
+}
+
+/**
+ * parses 'text', 'json' or 'none'.
+ * @return false if the mode is unknown
+ */
+inline bool parse_progress_mode(const std::string& name, ProgressMode& mode) {
+  if (name == "text")
+    mode = PROGRESS_TEXT;
+  else if (name == "json")
+    mode = PROGRESS_JSON;
+  else if (name == "none")
+    mode = PROGRESS_NONE;
+  else
+    return false;
+  return true;
+}
+
+/**
+ * reports the progress while in scope and prints the summary when leaving it.
+ */
+struct ProgressReporter {
+  ProgressReporter(ProgressMode mode, double interval) {
+    progress().begin(mode, interval);
+  }
+
+  ProgressReporter(const ProgressReporter&)            = delete;
+  ProgressReporter& operator=(const ProgressReporter&) = delete;
+
+  ~ProgressReporter() {
+    progress().finish();
+  }
+};
+
+#endif
@@ -2,77 +2,286 @@
 #define READER_H
 
 #include <sys/stat.h>
+#include <unistd.h>
 
 #include <cmath>
 #include <filesystem>
+#include <iostream>
+#include <memory>
 #include <string>
+#include <vector>
 
+#include "blockfile.h"
 #include "dataset.h"
 #include "defs.h"
 #include "fenparsing.h"
 #include "position.h"
+#include "progress.h"
 
-template<Format format>
-inline DataSet read(const std::string& file, uint64_t count = -1) {
-  constexpr uint64_t CHUNK_SIZE = (1 << 20);
+/**
+ * sequential reader for binary fin files. Positions are loaded in chunks so that files
+ * larger than the available memory can be processed. Block compressed files are detected
+ * by their magic and decompressed transparently. For columnar files only the selected columns
+ * are read, while the other members of the positions are left zero.
+ */
+struct FinReader {
+  FILE* f = nullptr;
+  std::unique_ptr<BlockReader> block {};
+  Header header {};
+  uint64_t remaining = 0;
 
-  // open the file
-  FILE* f;
-  if (format == BINARY) {
+  // last block decompressed by read_at
+  size_t cached_block = SIZE_MAX;
+  std::vector<Position> cache {};
+
+  explicit FinReader(const std::string& file, uint32_t columns = COLUMN_ALL) {
     f = fopen(file.c_str(), "rb");
-  } else if (format == TEXT) {
-    f = fopen(file.c_str(), "r");
+    if (f == nullptr)
+      return;
+
+    if (is_block_file(f)) {
+      fclose(f);
+      f     = nullptr;
+      block = std::make_unique<BlockReader>(file);
+      if (!block->is_open()) {
+        block.reset();
+        return;
+      }
+      block->columns = columns;
+      header         = block->header();
+      remaining      = header.position_count;
+      return;
+    }
+
+    if (fread(&header, sizeof(Header), 1, f) != 1) {
+      std::cout << "could not read the header of: " << file << std::endl;
+      fclose(f);
+      f = nullptr;
+      return;
+    }
+
+    // a partially written file holds less positions than its header claims
+    struct stat st {};
+    if (fstat(fileno(f), &st) == 0) {
+      uint64_t stored = ((uint64_t) st.st_size - sizeof(Header)) / sizeof(Position);
+      if (stored < header.position_count) {
+        std::cout << "truncated file: " << file << " holds " << stored << " of " << header.position_count
+                  << " position(s)" << std::endl;
+        header.position_count = stored;
+      }
+    }
+    remaining = header.position_count;
   }
 
-  // create the dataset
-  DataSet data_set {};
+  FinReader(const FinReader&)            = delete;
+  FinReader& operator=(const FinReader&) = delete;
 
-  // check if opening has worked
-  if (f == nullptr) {
-    std::cout << "could not open: " << file << std::endl;
-    return DataSet {};
+  ~FinReader() {
+    if (f != nullptr)
+      fclose(f);
+  }
+
+  bool is_open() const {
+    return f != nullptr || block != nullptr;
+  }
+
+  /**
+   * reads up to count positions into the memory pointed to.
+   * @return the amount of positions read, 0 once the file is exhausted
+   */
+  size_t read(Position* positions, size_t count) {
+    count = std::min<uint64_t>(count, remaining);
+    size_t read {};
+    if (block != nullptr) {
+      std::vector<Position> buffer {};
+      read = block->read(buffer, count);
+      std::copy(buffer.begin(), buffer.end(), positions);
+    } else {
+      read = count == 0 ? 0 : fread(positions, sizeof(Position), count, f);
+      if (read < count)
+        std::cout << "could not read " << count - read << " position(s)" << std::endl;
+    }
+    remaining = read == 0 ? 0 : remaining - read;
+    return read;
+  }
+
+  /**
+   * reads up to count positions into the given buffer and resizes it to the amount read.
+   * @return the amount of positions read, 0 once the file is exhausted
+   */
+  size_t read(std::vector<Position>& positions, size_t count) {
+    if (block != nullptr) {
+      size_t read = block->read(positions, std::min<uint64_t>(count, remaining));
+      remaining   = read == 0 ? 0 : remaining - read;
+      return read;
+    }
+    positions.resize(std::min<uint64_t>(count, remaining));
+    positions.resize(read(positions.data(), positions.size()));
+    return positions.size();
+  }
+
+  /**
+   * random access read of count positions starting at the given index. Does not affect the
+   * sequential reader.
+   * @return false if the range could not be read
+   */
+  bool read_at(uint64_t index, size_t count, Position* positions) {
+    if (index + count > header.position_count)
+      return false;
+
+    if (block == nullptr) {
+      ssize_t bytes = count * sizeof(Position);
+      return pread(fileno(f), positions, bytes, sizeof(Header) + index * sizeof(Position)) == bytes;
+    }
+
+    while (count > 0) {
+      size_t b = index / block->file_header.block_size;
+      if (b != cached_block) {
+        if (!block->read_block(b, cache))
+          return false;
+        cached_block = b;
+      }
+      size_t offset = index - block->block_start(b);
+      size_t n      = std::min<size_t>(count, cache.size() - offset);
+      std::copy(cache.begin() + offset, cache.begin() + offset + n, positions);
+      positions += n;
+      index += n;
+      count -= n;
+    }
+    return true;
   }
+};
+
+template<Format format>
+inline DataSet read(const std::string& file, uint64_t count = -1) {
+  constexpr uint64_t CHUNK_SIZE = (1 << 20);
+
+  // create the dataset
+  DataSet data_set {};
 
   if (format == BINARY) {
-    // read the header
-    fread(&data_set.header, sizeof(Header), 1, f);
+    FinReader reader {file};
+
+    // check if opening has worked
+    if (!reader.is_open()) {
+      std::cout << "could not open: " << file << std::endl;
+      return DataSet {};
+    }
+    data_set.header = reader.header;
 
     // compute how much data to read
     auto data_to_read = std::min(count, data_set.header.position_count);
     data_set.positions.resize(data_to_read);
-    int chunks = std::ceil(data_to_read / (float) CHUNK_SIZE);
 
     // actually load
-    for (int c = 0; c < chunks; c++) {
-      int start = c * CHUNK_SIZE;
-      int end   = c * CHUNK_SIZE + CHUNK_SIZE;
-      if (end > data_set.positions.size())
-        end = data_set.positions.size();
-      fread(&data_set.positions[start], sizeof(Position), end - start, f);
-      printf("\r[Reading positions] Current count=%d", end);
-      fflush(stdout);
+    StageCounters& stage = progress_stage("read");
+    uint64_t loaded      = 0;
+    while (loaded < data_to_read) {
+      const size_t read = reader.read(&data_set.positions[loaded], std::min(CHUNK_SIZE, data_to_read - loaded));
+      if (read == 0)
+        break;
+      loaded += read;
+      stage.add(read, read * sizeof(Position));
     }
-    std::cout << std::endl;
-  } else if (format == TEXT) {
-    int c = 0;
-    char buffer[128];
-    while (fgets(buffer, 128, f) && (c++) < count) {
-      // Remove trailing newline
-      buffer[strcspn(buffer, "\n")] = 0;
-      if (c % CHUNK_SIZE == 0) {
-        printf("\r[Reading positions] Current count=%d", c);
-        fflush(stdout);
-      }
-      data_set.positions.push_back(parse_fen(std::string(buffer)));
+
+    // the buffer is not cleared, so the positions missing after a short read are dropped
+    if (loaded < data_to_read) {
+      std::cout << "could only read " << loaded << " of " << data_to_read << " position(s) from " << file << std::endl;
+      data_set.positions.resize(loaded);
     }
-    printf("\r[Reading positions] Current count=%d", c - 1);
-    fflush(stdout);
+    return data_set;
+  }
+
+  // open the file
+  FILE* f = fopen(file.c_str(), "r");
 
-    std::cout << std::endl;
+  // check if opening has worked
+  if (f == nullptr) {
+    std::cout << "could not open: " << file << std::endl;
+    return DataSet {};
+  }
+
+  StageCounters& stage = progress_stage("read");
+  uint64_t c           = 0;
+  uint64_t bytes       = 0;
+  char buffer[128];
+  while (c < count && fgets(buffer, 128, f)) {
+    // Remove trailing newline
+    bytes += strlen(buffer);
+    buffer[strcspn(buffer, "\n")] = 0;
+    if (++c % CHUNK_SIZE == 0) {
+      stage.add(CHUNK_SIZE, bytes);
+      bytes = 0;
+    }
+    data_set.positions.push_back(parse_fen(std::string(buffer)));
   }
+  stage.add(c % CHUNK_SIZE, bytes);
 
   fclose(f);
   return data_set;
 }
 
+/**
+ * reads the positions of the given binary files in chunks, one file after the other. Files which
+ * cannot be opened are skipped. Columnar files only load the given columns.
+ */
+struct FinSource {
+  std::vector<std::string> files;
+  size_t chunk_size;
+  uint32_t columns;
+  size_t next_file = 0;
+  std::unique_ptr<FinReader> reader {};
+  uint64_t total = 0;
+  StageCounters& stage;
+
+  explicit FinSource(const std::vector<std::string>& p_files,
+                     size_t p_chunk_size = (1 << 20),
+                     uint32_t p_columns  = COLUMN_ALL) :
+      files(p_files), chunk_size(p_chunk_size), columns(p_columns), stage(progress_stage("read")) {}
+
+  /**
+   * reads the next chunk into the given buffer.
+   * @return false once all files are exhausted
+   */
+  bool next(std::vector<Position>& positions) {
+    while (true) {
+      if (reader != nullptr && reader->read(positions, chunk_size) > 0) {
+        total += positions.size();
+        stage.add(positions.size(), positions.size() * sizeof(Position));
+        return true;
+      }
+      reader.reset();
+
+      if (next_file == files.size())
+        return false;
+      const std::string& file = files[next_file++];
+      reader                  = std::make_unique<FinReader>(file, columns);
+      if (!reader->is_open()) {
+        std::cout << "could not open: " << file << std::endl;
+        reader.reset();
+        continue;
+      }
+      std::cout << "Reading from " << file << " with " << reader->header.position_count << " position(s)"
+                << std::endl;
+    }
+  }
+};
+
+/**
+ * streams all positions of the given binary files in chunks and calls func(positions) for each chunk.
+ * Files which cannot be opened are skipped. Columnar files only load the given columns.
+ * @return the total amount of positions streamed
+ */
+template<typename F>
+inline uint64_t stream_positions(const std::vector<std::string>& files,
+                                 F&& func,
+                                 size_t chunk_size = (1 << 20),
+                                 uint32_t columns  = COLUMN_ALL) {
+  FinSource source {files, chunk_size, columns};
+  std::vector<Position> positions {};
+  while (source.next(positions))
+    func(positions);
+  return source.total;
+}
+
 #endif
@@ -0,0 +1,189 @@
+#ifndef REBALANCE_H
+#define REBALANCE_H
+
+#include <algorithm>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "hash.h"
+#include "material.h"
+#include "pipeline.h"
+#include "position.h"
+#include "reader.h"
+#include "writer.h"
+
+/**
+ * describes the histogram cells used for rebalancing. Scores are clamped to [-score_limit, score_limit)
+ * and binned into bins of score_width whose edges are symmetric around 0, which requires twice the
+ * limit to be a multiple of the width. Piece counts are grouped into piece_buckets buckets. A
+ * dimension with a single bin is effectively ignored.
+ */
+struct RebalanceBins {
+  int score_width   = 100;
+  int score_limit   = 1000;
+  size_t score_bins = 1;
+  size_t piece_bins = 1;
+
+  RebalanceBins(bool by_score, int p_score_width, int p_score_limit, size_t piece_buckets) :
+      score_width(p_score_width), score_limit(p_score_limit) {
+    score_bins = by_score ? (2 * score_limit) / score_width : 1;
+    piece_bins = piece_buckets;
+  }
+
+  size_t size() const {
+    return score_bins * piece_bins;
+  }
+
+  size_t score_bin(int16_t score) const {
+    if (score_bins == 1)
+      return 0;
+    int clamped = std::min(std::max((int) score, -score_limit), score_limit - 1);
+    return (clamped + score_limit) / score_width;
+  }
+
+  size_t cell(const Position& position) const {
+    size_t piece_bin = piece_bins == 1 ? 0 : piece_count_bucket(position.get_piece_count(), piece_bins);
+    return score_bin(position.m_result.score) * piece_bins + piece_bin;
+  }
+
+  std::string label(size_t cell) const {
+    std::string res {};
+    if (score_bins > 1) {
+      // the outer bins also contain the clamped scores
+      size_t bin = cell / piece_bins;
+      int lower  = (int) bin * score_width - score_limit;
+      res += "score " + (bin == 0 ? "" : std::to_string(lower)) + ".."
+             + (bin == score_bins - 1 ? "" : std::to_string(lower + score_width - 1));
+    }
+    if (piece_bins > 1) {
+      res += res.empty() ? "" : ", ";
+      res += "pieces " + piece_count_bucket_label(cell % piece_bins, piece_bins);
+    }
+    return res.empty() ? "all" : res;
+  }
+};
+
+/**
+ * chunk of positions with the histogram cells counted or kept by the workers.
+ */
+struct RebalanceBatch {
+  uint64_t offset = 0;
+  std::vector<Position> positions {};
+  std::vector<uint32_t> destinations {};
+  std::vector<uint64_t> counts {};
+};
+
+/**
+ * counts the positions per histogram cell in parallel.
+ */
+inline std::vector<uint64_t> rebalance_histogram(const std::vector<std::string>& files, const RebalanceBins& bins) {
+  std::vector<uint64_t> counts(bins.size());
+
+  FinSource source {files, 1 << 20, COLUMN_OCCUPANCY | COLUMN_RESULT};
+  run_pipeline<RebalanceBatch>(
+    "histogram",
+    [&](RebalanceBatch& batch) { return source.next(batch.positions); },
+    [&](RebalanceBatch& batch) {
+      batch.counts.assign(bins.size(), 0);
+      for (const Position& p : batch.positions)
+        batch.counts[bins.cell(p)]++;
+    },
+    [&](RebalanceBatch& batch) {
+      for (size_t c = 0; c < counts.size(); c++)
+        counts[c] += batch.counts[c];
+      return true;
+    },
+    false);
+  return counts;
+}
+
+/**
+ * resamples the given files to match the target distribution over the histogram cells.
+ * A first pass counts the positions per cell, from which the acceptance probability of each cell
+ * is computed such that as many positions as possible are kept. The second pass then keeps each
+ * position with the acceptance probability of its cell. The decision only depends on the seed and
+ * the index of the position, so the result does not depend on the amount of threads.
+ * @param files     files to resample
+ * @param output    output file
+ * @param bins      histogram cells
+ * @param target    relative target weight per cell
+ * @param seed      seed for the rejection sampling
+ * @return          false if the output could not be written
+ */
+inline bool rebalance(const std::vector<std::string>& files,
+                      const std::string& output,
+                      const RebalanceBins& bins,
+                      const std::vector<double>& target,
+                      Key seed) {
+  std::cout << "Collecting statistics" << std::endl;
+  std::vector<uint64_t> counts = rebalance_histogram(files, bins);
+
+  // the largest scale for which no cell needs more positions than it has
+  double scale = -1;
+  for (size_t c = 0; c < bins.size(); c++)
+    if (counts[c] > 0 && target[c] > 0)
+      scale = scale < 0 ? counts[c] / target[c] : std::min(scale, counts[c] / target[c]);
+
+  std::vector<double> acceptance(bins.size());
+  for (size_t c = 0; c < bins.size(); c++)
+    acceptance[c] = counts[c] > 0 && scale > 0 ? std::min(1.0, scale * target[c] / counts[c]) : 0;
+
+  std::vector<std::unique_ptr<FinWriter>> writers {};
+  writers.push_back(std::make_unique<FinWriter>(output));
+  if (!writers[0]->is_open())
+    return false;
+
+  std::cout << "Resampling" << std::endl;
+  std::vector<uint64_t> kept(bins.size());
+  uint64_t offset = 0;
+
+  FinSource source {files};
+  bool success = run_pipeline<RebalanceBatch>(
+    "rebalance",
+    [&](RebalanceBatch& batch) {
+      batch.offset = offset;
+      if (!source.next(batch.positions))
+        return false;
+      offset += batch.positions.size();
+      return true;
+    },
+    [&](RebalanceBatch& batch) {
+      batch.destinations.resize(batch.positions.size());
+      batch.counts.assign(bins.size(), 0);
+      for (size_t i = 0; i < batch.positions.size(); i++) {
+        size_t cell           = bins.cell(batch.positions[i]);
+        double u              = (mix_hash(seed ^ mix_hash(batch.offset + i)) >> 11) * 0x1.0p-53;
+        bool keep             = u < acceptance[cell];
+        batch.destinations[i] = keep ? 0 : UINT32_MAX;
+        batch.counts[cell] += keep;
+      }
+    },
+    [&](RebalanceBatch& batch) {
+      for (size_t c = 0; c < kept.size(); c++)
+        kept[c] += batch.counts[c];
+      return write_routed(batch.positions, batch.destinations, writers);
+    },
+    true);
+  if (!writers[0]->close() || !success)
+    return false;
+
+  size_t width = 8;
+  for (size_t c = 0; c < bins.size(); c++)
+    width = std::max(width, bins.label(c).size() + 2);
+
+  std::cout << std::setw(width) << "Bucket" << std::setw(14) << "Input" << std::setw(12) << "Accept" << std::setw(14)
+            << "Output" << std::endl;
+  for (size_t c = 0; c < bins.size(); c++) {
+    if (counts[c] == 0)
+      continue;
+    std::cout << std::setw(width) << bins.label(c) << std::setw(14) << counts[c] << std::setw(12) << std::fixed
+              << std::setprecision(6) << acceptance[c] << std::setw(14) << kept[c] << std::endl;
+  }
+  std::cout << "Kept " << writers[0]->header.position_count << " of " << offset << " position(s)" << std::endl;
+  return true;
+}
+
+#endif
@@ -0,0 +1,164 @@
+#ifndef SAMPLE_H
+#define SAMPLE_H
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <iostream>
+#include <numeric>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "dataset.h"
+#include "manifest.h"
+#include "position.h"
+#include "reader.h"
+#include "threads.h"
+
+#define SAMPLE_CHUNK_SIZE (1 << 16)
+
+/**
+ * draws count distinct indices uniformly from [0, total) and returns them sorted.
+ * sparse samples are drawn directly and deduplicated, dense samples use selection sampling
+ * which runs in constant memory besides the result.
+ */
+inline std::vector<uint64_t> sample_indices(uint64_t total, uint64_t count, std::mt19937_64& gen) {
+  std::vector<uint64_t> indices {};
+
+  if (count >= total) {
+    indices.resize(total);
+    std::iota(indices.begin(), indices.end(), 0);
+    return indices;
+  }
+
+  if (count <= total / 16) {
+    std::uniform_int_distribution<uint64_t> distrib(0, total - 1);
+    indices.reserve(count + count / 16 + 16);
+    while (indices.size() < count) {
+      uint64_t missing = count - indices.size();
+      for (uint64_t i = 0; i < missing + missing / 32 + 16; i++)
+        indices.push_back(distrib(gen));
+      std::sort(indices.begin(), indices.end());
+      indices.erase(std::unique(indices.begin(), indices.end()), indices.end());
+    }
+    // drop the surplus uniformly
+    std::shuffle(indices.begin(), indices.end(), gen);
+    indices.resize(count);
+    std::sort(indices.begin(), indices.end());
+    return indices;
+  }
+
+  std::uniform_real_distribution<double> uniform(0, 1);
+  indices.reserve(count);
+  uint64_t needed = count;
+  for (uint64_t i = 0; i < total && needed > 0; i++) {
+    if (uniform(gen) * (total - i) < needed) {
+      indices.push_back(i);
+      needed--;
+    }
+  }
+  return indices;
+}
+
+/**
+ * samples count positions uniformly without replacement from all the given files and writes them
+ * into the output file. Since the positions can be accessed by index, the sampled indices are
+ * computed upfront from the headers and each file only reads the records or blocks it needs. Files are processed
+ * in parallel and write their samples directly into their slice of the output. Manifests among the files are
+ * expanded, using their stored counts instead of opening each file upfront.
+ * @param files     files or manifests to sample from
+ * @param output    output file
+ * @param count     amount of positions to sample
+ * @param seed      seed for the random number generator
+ * @return          false if the output could not be written
+ */
+inline bool sample(const std::vector<std::string>& inputs, const std::string& output, uint64_t count, uint64_t seed) {
+  Manifest manifest {};
+  if (!Manifest::from_files(inputs, manifest))
+    return false;
+
+  const std::vector<std::string>& files = manifest.files;
+  const std::vector<uint64_t>& offsets  = manifest.starts;
+  const uint64_t total                  = manifest.size();
+
+  std::mt19937_64 gen(seed);
+  std::vector<uint64_t> indices = sample_indices(total, count, gen);
+
+  std::cout << "Sampling " << indices.size() << " of " << total << " position(s) from " << files.size()
+            << " file(s) with seed " << seed << std::endl;
+
+  int out = open(output.c_str(), O_WRONLY | O_CREAT | O_EXCL, 0644);
+  if (out < 0) {
+    std::cout << "could not open: " << output << std::endl;
+    return false;
+  }
+
+  Header header {};
+  header.position_count = indices.size();
+  std::atomic<bool> success {pwrite(out, &header, sizeof(Header), 0) == (ssize_t) sizeof(Header)};
+
+  std::atomic<size_t> next_file {0};
+  parallel_for(thread_count(), [&](size_t, size_t, int) {
+    std::vector<Position> chunk(SAMPLE_CHUNK_SIZE);
+    std::vector<Position> samples {};
+
+    for (size_t f = next_file++; f < files.size(); f = next_file++) {
+      auto first = std::lower_bound(indices.begin(), indices.end(), offsets[f]);
+      auto last  = std::lower_bound(first, indices.end(), offsets[f + 1]);
+      if (first == last)
+        continue;
+
+      FinReader reader {files[f]};
+      if (!reader.is_open()) {
+        success = false;
+        continue;
+      }
+
+      // flushes the collected samples into their slice of the output
+      uint64_t written = first - indices.begin();
+      auto flush       = [&]() {
+        off_t offset = sizeof(Header) + written * sizeof(Position);
+        size_t bytes = samples.size() * sizeof(Position);
+        if (pwrite(out, samples.data(), bytes, offset) != (ssize_t) bytes)
+          success = false;
+        written += samples.size();
+        samples.clear();
+      };
+
+      for (auto it = first; it != last;) {
+        uint64_t chunk_start = (*it - offsets[f]) / SAMPLE_CHUNK_SIZE * SAMPLE_CHUNK_SIZE;
+        uint64_t chunk_end   = std::min(chunk_start + SAMPLE_CHUNK_SIZE, offsets[f + 1] - offsets[f]);
+        auto chunk_last      = std::lower_bound(it, last, offsets[f] + chunk_end);
+
+        // sparse chunks read the single records, dense chunks are read at once
+        if ((size_t) (chunk_last - it) * 64 < SAMPLE_CHUNK_SIZE) {
+          for (; it != chunk_last; it++) {
+            Position p {};
+            if (!reader.read_at(*it - offsets[f], 1, &p))
+              success = false;
+            samples.push_back(p);
+          }
+        } else {
+          if (!reader.read_at(chunk_start, chunk_end - chunk_start, chunk.data()))
+            success = false;
+          for (; it != chunk_last; it++)
+            samples.push_back(chunk[*it - offsets[f] - chunk_start]);
+        }
+        if (samples.size() >= SAMPLE_CHUNK_SIZE)
+          flush();
+      }
+      flush();
+
+      std::cout << "Sampled " << (last - first) << " position(s) from " << files[f] << std::endl;
+    }
+  });
+
+  close(out);
+  return success;
+}
+
+#endif
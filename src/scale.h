@@ -0,0 +1,195 @@
+#ifndef SCALE_H
+#define SCALE_H
+
+#include <cmath>
+#include <cstdint>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "material.h"
+#include "position.h"
+#include "reader.h"
+#include "threads.h"
+
+#define SCALE_SCORE_RANGE (1 << 16)
+#define SCALE_SCORE_SHIFT (1 << 15)
+
+enum ScaleLoss {
+  MSE,
+  CROSS_ENTROPY
+};
+
+/**
+ * sufficient statistics for fitting sigmoid(score / K) against the game results.
+ * Since the score is a 16 bit integer, all positions collapse into one entry per distinct score,
+ * which makes each loss evaluation independent of the amount of positions in the corpus.
+ */
+struct ScaleSamples {
+  std::vector<float> score {};
+  std::vector<double> count {};
+  std::vector<double> target_sum {};
+  std::vector<double> target_squared_sum {};
+  double total = 0;
+
+  /**
+   * computes the mean loss of sigmoid(score / scale) against the targets.
+   * the loop only works on flat arrays so the compiler can vectorise it.
+   */
+  double loss(double scale, ScaleLoss type) const {
+    const float inv_scale = 1.0f / (float) scale;
+    double sum            = 0;
+    for (size_t i = 0; i < score.size(); i++) {
+      double p = 1.0 / (1.0 + std::exp(-score[i] * inv_scale));
+      if (type == MSE) {
+        sum += count[i] * p * p - 2 * p * target_sum[i] + target_squared_sum[i];
+      } else {
+        p = std::min(std::max(p, 1e-12), 1 - 1e-12);
+        sum -= target_sum[i] * std::log(p) + (count[i] - target_sum[i]) * std::log(1 - p);
+      }
+    }
+    return total > 0 ? sum / total : 0;
+  }
+};
+
+/**
+ * per bucket histogram over (score, wdl) which gets accumulated while streaming the data.
+ */
+struct ScaleHistogram {
+  size_t buckets;
+  std::vector<uint64_t> counts {};
+
+  explicit ScaleHistogram(size_t p_buckets) : buckets(p_buckets), counts(p_buckets * SCALE_SCORE_RANGE * 3) {}
+
+  static size_t index(size_t bucket, int16_t score, int8_t wdl) {
+    return (bucket * SCALE_SCORE_RANGE + (score + SCALE_SCORE_SHIFT)) * 3 + (std::min(std::max((int) wdl, -1), 1) + 1);
+  }
+
+  ScaleSamples samples(size_t bucket) const {
+    ScaleSamples res {};
+    for (int s = 0; s < SCALE_SCORE_RANGE; s++) {
+      const uint64_t* c = &counts[(bucket * SCALE_SCORE_RANGE + s) * 3];
+      double n          = (double) c[0] + c[1] + c[2];
+      if (n == 0)
+        continue;
+      res.score.push_back((float) (s - SCALE_SCORE_SHIFT));
+      res.count.push_back(n);
+      res.target_sum.push_back(0.5 * c[1] + c[2]);
+      res.target_squared_sum.push_back(0.25 * c[1] + c[2]);
+      res.total += n;
+    }
+    return res;
+  }
+};
+
+/**
+ * golden section search for the scale minimising the loss within [lower, upper].
+ */
+inline double fit_scale(const ScaleSamples& samples, ScaleLoss type, double lower, double upper) {
+  const double ratio = (std::sqrt(5.0) - 1) / 2;
+
+  double a  = lower;
+  double b  = upper;
+  double c  = b - ratio * (b - a);
+  double d  = a + ratio * (b - a);
+  double fc = samples.loss(c, type);
+  double fd = samples.loss(d, type);
+
+  while (b - a > 1e-3) {
+    if (fc < fd) {
+      b  = d;
+      d  = c;
+      fd = fc;
+      c  = b - ratio * (b - a);
+      fc = samples.loss(c, type);
+    } else {
+      a  = c;
+      c  = d;
+      fc = fd;
+      d  = a + ratio * (b - a);
+      fd = samples.loss(d, type);
+    }
+  }
+  return (a + b) / 2;
+}
+
+/**
+ * streams all the given files once, builds the (score, wdl) histograms in parallel and
+ * fits the optimal scale for sigmoid(score / K) per piece count bucket.
+ * @param files         files to read
+ * @param type          loss function to minimise
+ * @param buckets       amount of piece count buckets to fit separately
+ * @param lower         lower bound for the scale
+ * @param upper         upper bound for the scale
+ * @param curve_points  amount of points at which the loss curve is reported
+ */
+inline void fit_scale(const std::vector<std::string>& files,
+                      ScaleLoss type,
+                      size_t buckets      = 1,
+                      double lower        = 1,
+                      double upper        = 2000,
+                      size_t curve_points = 16) {
+  ScaleHistogram histogram {buckets};
+
+  // each thread counts into its own 32 bit histogram which is flushed long before it can overflow
+  std::vector<std::vector<uint32_t>> local(thread_count(), std::vector<uint32_t>(histogram.counts.size()));
+  std::vector<uint64_t> pending(thread_count());
+
+  auto flush = [&](size_t t) {
+    for (size_t i = 0; i < local[t].size(); i++)
+      histogram.counts[i] += local[t][i];
+    std::fill(local[t].begin(), local[t].end(), 0);
+    pending[t] = 0;
+  };
+
+  // only the piece count and the result are needed, which skips most of columnar files
+  stream_positions(files, [&](const std::vector<Position>& positions) {
+    parallel_for(positions.size(), [&](size_t begin, size_t end, int t) {
+      uint32_t* counts = local[t].data();
+      for (size_t i = begin; i < end; i++) {
+        const Position& p = positions[i];
+        size_t bucket     = buckets == 1 ? 0 : piece_count_bucket(p.get_piece_count(), buckets);
+        counts[ScaleHistogram::index(bucket, p.m_result.score, p.m_result.wdl)]++;
+      }
+      pending[t] += end - begin;
+    });
+    for (size_t t = 0; t < local.size(); t++)
+      if (pending[t] > (1ULL << 31))
+        flush(t);
+  }, 1 << 20, COLUMN_OCCUPANCY | COLUMN_RESULT);
+
+  for (size_t t = 0; t < local.size(); t++)
+    flush(t);
+
+  std::cout << std::setw(8) << "Bucket" << std::setw(10) << "Pieces" << std::setw(14) << "Positions" << std::setw(12)
+            << "K" << std::setw(14) << "Loss" << std::endl;
+
+  std::vector<ScaleSamples> bucket_samples {};
+  for (size_t b = 0; b < buckets; b++) {
+    bucket_samples.push_back(histogram.samples(b));
+    const ScaleSamples& samples = bucket_samples.back();
+    if (samples.total == 0)
+      continue;
+
+    double scale = fit_scale(samples, type, lower, upper);
+    std::cout << std::setw(8) << b << std::setw(10) << piece_count_bucket_label(b, buckets)
+              << std::setw(14) << (uint64_t) samples.total << std::setw(12) << std::fixed << std::setprecision(2)
+              << scale << std::setw(14) << std::setprecision(8) << samples.loss(scale, type) << std::endl;
+  }
+
+  if (curve_points < 2)
+    return;
+
+  std::cout << std::endl << "Loss curve" << std::endl;
+  for (size_t i = 0; i < curve_points; i++) {
+    double scale = lower + (upper - lower) * i / (curve_points - 1);
+    std::cout << std::setw(12) << std::fixed << std::setprecision(2) << scale;
+    for (const auto& samples : bucket_samples)
+      if (samples.total > 0)
+        std::cout << std::setw(14) << std::setprecision(8) << samples.loss(scale, type);
+    std::cout << std::endl;
+  }
+}
+
+#endif
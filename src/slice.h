@@ -0,0 +1,152 @@
+#ifndef SLICE_H
+#define SLICE_H
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "copy.h"
+#include "dataset.h"
+#include "manifest.h"
+#include "position.h"
+#include "threads.h"
+
+/**
+ * extraction of contiguous ranges of positions. Since raw positions have a fixed size, the byte
+ * offsets of any range follow from its indices, so ranges are copied by the kernel without reading
+ * anything else. Ranges are cut into chunks of SLICE_CHUNK_SIZE positions which are copied in
+ * parallel. Ranges of block compressed inputs are decompressed and written instead.
+ */
+#define SLICE_CHUNK_SIZE (1 << 22)
+
+struct SliceTask {
+  // global index of the first position and amount of positions to copy
+  uint64_t index;
+  uint64_t count;
+  // output file and index of the first position within it
+  int out;
+  uint64_t out_index;
+};
+
+/**
+ * copies count positions starting at the given global index into the output.
+ * @return false if any of the positions could not be copied
+ */
+inline bool copy_positions(ManifestReader& reader, const SliceTask& task) {
+  std::vector<Position> buffer {};
+  uint64_t index = task.index;
+  uint64_t count = task.count;
+  off_t offset   = sizeof(Header) + task.out_index * sizeof(Position);
+
+  while (count > 0) {
+    size_t f       = reader.manifest.locate(index);
+    uint64_t local = index - reader.manifest.starts[f];
+    uint64_t n     = std::min<uint64_t>(count, reader.manifest.counts[f] - local);
+    FinReader* in  = reader.reader(f);
+    if (in == nullptr)
+      return false;
+
+    if (in->block == nullptr) {
+      if (!copy_range(fileno(in->f), sizeof(Header) + local * sizeof(Position), task.out, offset, n * sizeof(Position)))
+        return false;
+    } else {
+      for (uint64_t done = 0; done < n; done += buffer.size()) {
+        buffer.resize(std::min<uint64_t>(n - done, BLOCK_POSITIONS));
+        ssize_t bytes = buffer.size() * sizeof(Position);
+        if (!in->read_at(local + done, buffer.size(), buffer.data())
+            || pwrite(task.out, buffer.data(), bytes, offset + done * sizeof(Position)) != bytes)
+          return false;
+      }
+    }
+    index += n;
+    count -= n;
+    offset += n * sizeof(Position);
+  }
+  return true;
+}
+
+/**
+ * writes the given ranges of the dataset into the outputs, each of which is split into chunks
+ * which are processed in parallel.
+ * @return false if any of the ranges could not be copied
+ */
+inline bool copy_slices(const Manifest& manifest, const std::vector<SliceTask>& slices) {
+  std::vector<SliceTask> tasks {};
+  for (const SliceTask& s : slices)
+    for (uint64_t first = 0; first < s.count; first += SLICE_CHUNK_SIZE)
+      tasks.push_back(SliceTask {s.index + first,
+                                 std::min<uint64_t>(SLICE_CHUNK_SIZE, s.count - first),
+                                 s.out,
+                                 s.out_index + first});
+
+  std::atomic<bool> success {true};
+  std::atomic<size_t> next {0};
+  parallel_for(thread_count(), [&](size_t, size_t, int) {
+    ManifestReader reader {manifest};
+    for (size_t t = next++; t < tasks.size(); t = next++)
+      if (!copy_positions(reader, tasks[t]))
+        success = false;
+  });
+  return success;
+}
+
+/**
+ * splits the dataset into contiguous ranges, one per output, whose sizes follow the weights. The
+ * outputs are raw fin files.
+ * @param manifest  files to split, addressed by their global index
+ * @param outputs   output files, one per range
+ * @param weights   relative size of each range
+ * @param first     global index of the first position to split
+ * @param count     amount of positions to split
+ * @return          false if any of the outputs could not be written
+ */
+inline bool split_by_range(const Manifest& manifest,
+                           const std::vector<std::string>& outputs,
+                           const std::vector<double>& weights,
+                           uint64_t first,
+                           uint64_t count) {
+  double total = 0;
+  for (double w : weights)
+    total += w;
+
+  std::vector<int> files {};
+  std::vector<SliceTask> slices {};
+  bool success      = true;
+  double cumulative = 0;
+  uint64_t start    = first;
+
+  for (size_t o = 0; o < outputs.size(); o++) {
+    // the last range always ends at the end so rounding cannot drop positions
+    cumulative += weights[o];
+    uint64_t end = first + (o + 1 == outputs.size() ? count : (uint64_t) std::llround(count * cumulative / total));
+
+    int out = open(outputs[o].c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (out < 0) {
+      std::cout << "could not open: " << outputs[o] << std::endl;
+      success = false;
+      break;
+    }
+    files.push_back(out);
+
+    Header header {};
+    header.position_count = end - start;
+    success &= pwrite(out, &header, sizeof(Header), 0) == (ssize_t) sizeof(Header);
+    slices.push_back(SliceTask {start, end - start, out, 0});
+    std::cout << outputs[o] << ": [" << start << ", " << end << ")" << std::endl;
+    start = end;
+  }
+
+  success = success && copy_slices(manifest, slices);
+  for (int out : files)
+    success &= close(out) == 0;
+  return success;
+}
+
+#endif
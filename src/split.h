@@ -0,0 +1,76 @@
+#ifndef SPLIT_H
+#define SPLIT_H
+
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "hash.h"
+#include "pipeline.h"
+#include "position.h"
+#include "reader.h"
+#include "writer.h"
+
+/**
+ * assigns each position to one of the outputs based on the hash of its board state. Since the
+ * assignment only depends on the position and the seed, the same position always ends up in the
+ * same partition across re-runs and across different corpora.
+ * @param files     files to split
+ * @param outputs   output files, one per partition
+ * @param weights   relative size of each partition
+ * @param seed      seed of the hash, changing it produces a different split
+ * @return          false if any of the inputs could not be read or the outputs could not be written
+ */
+inline bool split_by_hash(const std::vector<std::string>& files,
+                          const std::vector<std::string>& outputs,
+                          const std::vector<double>& weights,
+                          Key seed = 0) {
+  std::vector<std::unique_ptr<FinWriter>> writers {};
+  for (const auto& output : outputs) {
+    writers.push_back(std::make_unique<FinWriter>(output));
+    if (!writers.back()->is_open())
+      return false;
+  }
+
+  // cumulative fraction of the hash space covered by each partition
+  std::vector<double> thresholds {};
+  double total = 0;
+  for (double w : weights)
+    total += w;
+  double sum = 0;
+  for (double w : weights)
+    thresholds.push_back((sum += w) / total);
+  thresholds.back() = 1;
+
+  // the workers hash the positions of each chunk, the sink writes the chunks in the order of the files
+  struct SplitBatch {
+    std::vector<Position> positions {};
+    std::vector<uint32_t> destinations {};
+  };
+
+  FinSource source {files};
+  bool success = run_pipeline<SplitBatch>(
+    "split",
+    [&](SplitBatch& batch) { return source.next(batch.positions); },
+    [&](SplitBatch& batch) {
+      batch.destinations.resize(batch.positions.size());
+      for (size_t i = 0; i < batch.positions.size(); i++) {
+        double u   = (position_hash(batch.positions[i], seed) >> 11) * 0x1.0p-53;
+        uint32_t d = 0;
+        while (u >= thresholds[d])
+          d++;
+        batch.destinations[i] = d;
+      }
+    },
+    [&](SplitBatch& batch) { return write_routed(batch.positions, batch.destinations, writers); },
+    true);
+
+  for (size_t i = 0; i < outputs.size(); i++) {
+    success &= writers[i]->close();
+    std::cout << outputs[i] << " " << writers[i]->header.position_count << std::endl;
+  }
+  return success;
+}
+
+#endif
@@ -0,0 +1,250 @@
+#ifndef THREADS_H
+#define THREADS_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * shared work stealing thread pool. Each worker owns a deque of tasks: tasks submitted by a worker
+ * are pushed to the back of its own deque and taken back from there, so nested work stays local,
+ * while idle workers steal from the front of the other deques. Tasks submitted from outside the pool
+ * go through a shared deque. Threads waiting for a group of tasks keep executing queued tasks, so
+ * tasks may submit and wait for tasks themselves.
+ */
+#define POOL_MAX_WORKERS (255)
+
+/**
+ * returns a reference to the amount of worker threads used by the parallel passes.
+ * defaults to the amount of hardware threads available.
+ */
+inline int& thread_count() {
+  static int count = std::max(1, (int) std::thread::hardware_concurrency());
+  return count;
+}
+
+struct ThreadPool {
+  struct Queue {
+    std::mutex mutex {};
+    std::deque<std::function<void()>> tasks {};
+  };
+
+  std::unique_ptr<Queue> queues[POOL_MAX_WORKERS] {};
+  std::atomic<int> size {0};
+  Queue shared {};
+  std::vector<std::thread> threads {};
+  std::mutex grow_mutex {};
+
+  // amount of queued tasks, increased under the mutex so sleeping workers cannot miss them
+  std::atomic<size_t> queued {0};
+  std::mutex sleep_mutex {};
+  std::condition_variable wake {};
+  bool stop = false;
+
+  static int& worker_index() {
+    static thread_local int index = -1;
+    return index;
+  }
+
+  bool pop(Queue& queue, bool back, std::function<void()>& task) {
+    std::lock_guard<std::mutex> lock {queue.mutex};
+    if (queue.tasks.empty())
+      return false;
+    if (back) {
+      task = std::move(queue.tasks.back());
+      queue.tasks.pop_back();
+    } else {
+      task = std::move(queue.tasks.front());
+      queue.tasks.pop_front();
+    }
+    queued--;
+    return true;
+  }
+
+  void run(int index) {
+    worker_index() = index;
+    while (true) {
+      if (try_run_one())
+        continue;
+      std::unique_lock<std::mutex> lock {sleep_mutex};
+      wake.wait(lock, [&]() { return stop || queued > 0; });
+      if (stop)
+        return;
+    }
+  }
+
+  ThreadPool() = default;
+
+  ThreadPool(const ThreadPool&)            = delete;
+  ThreadPool& operator=(const ThreadPool&) = delete;
+
+  ~ThreadPool() {
+    {
+      std::lock_guard<std::mutex> lock {sleep_mutex};
+      stop = true;
+    }
+    wake.notify_all();
+    for (auto& thread : threads)
+      thread.join();
+  }
+
+  /**
+   * starts workers until there are at least the given amount. Workers are never stopped before the
+   * pool is destroyed.
+   */
+  void reserve(int workers) {
+    workers = std::min(workers, POOL_MAX_WORKERS);
+    if (size >= workers)
+      return;
+    std::lock_guard<std::mutex> lock {grow_mutex};
+    for (int w = size; w < workers; w++) {
+      queues[w] = std::make_unique<Queue>();
+      size++;
+      threads.emplace_back([this, w]() { run(w); });
+    }
+  }
+
+  void submit(std::function<void()> task) {
+    const int index = worker_index();
+    Queue& queue    = index >= 0 ? *queues[index] : shared;
+    {
+      std::lock_guard<std::mutex> lock {queue.mutex};
+      queue.tasks.push_back(std::move(task));
+    }
+    {
+      std::lock_guard<std::mutex> lock {sleep_mutex};
+      queued++;
+    }
+    wake.notify_one();
+  }
+
+  /**
+   * executes one queued task, preferring the own deque, then the shared one, then stealing.
+   * @return false if no task was queued
+   */
+  bool try_run_one() {
+    std::function<void()> task {};
+    const int index = worker_index();
+    bool found      = (index >= 0 && pop(*queues[index], true, task)) || pop(shared, false, task);
+
+    const int workers = size;
+    for (int i = 1; !found && i <= workers; i++) {
+      const int victim = (std::max(index, 0) + i) % workers;
+      found            = victim != index && pop(*queues[victim], false, task);
+    }
+    if (found)
+      task();
+    return found;
+  }
+};
+
+/**
+ * returns the pool shared by all parallel passes, with thread_count() - 1 workers besides the
+ * calling thread.
+ */
+inline ThreadPool& thread_pool() {
+  static ThreadPool pool {};
+  pool.reserve(thread_count() - 1);
+  return pool;
+}
+
+/**
+ * tasks which can be waited for together. At most limit tasks of the group are in flight at once,
+ * submitting more waits until one finishes, which bounds the memory held by in-flight tasks.
+ */
+struct TaskGroup {
+  std::atomic<size_t> pending {0};
+  size_t limit;
+  std::mutex mutex {};
+  std::condition_variable done {};
+
+  /**
+   * executes queued tasks, or sleeps briefly if there are none, until the predicate holds.
+   */
+  template<typename P>
+  void help_until(P&& predicate) {
+    ThreadPool& pool = thread_pool();
+    while (!predicate()) {
+      if (pool.try_run_one())
+        continue;
+      std::unique_lock<std::mutex> lock {mutex};
+      done.wait_for(lock, std::chrono::milliseconds(1), predicate);
+    }
+  }
+
+  explicit TaskGroup(size_t p_limit = SIZE_MAX) : limit(std::max<size_t>(1, p_limit)) {}
+
+  TaskGroup(const TaskGroup&)            = delete;
+  TaskGroup& operator=(const TaskGroup&) = delete;
+
+  ~TaskGroup() {
+    wait();
+  }
+
+  template<typename F>
+  void run(F&& func) {
+    help_until([&]() { return pending < limit; });
+    pending++;
+    thread_pool().submit([this, func = std::forward<F>(func)]() mutable {
+      func();
+      std::lock_guard<std::mutex> lock {mutex};
+      pending--;
+      done.notify_all();
+    });
+  }
+
+  void wait() {
+    help_until([&]() { return pending == 0; });
+    // the last task may still hold the mutex after decrementing
+    std::lock_guard<std::mutex> lock {mutex};
+  }
+};
+
+/**
+ * splits the range [0, size) into one contiguous slice per thread and calls
+ * func(begin, end, thread_id) for each slice. Returns once all slices are done. Callers which must
+ * not depend on the global setting, like concurrent library calls, pass their own amount of threads.
+ */
+template<typename F>
+inline void parallel_for(size_t size, F&& func, int max_threads = thread_count()) {
+  const int threads = (int) std::max<size_t>(1, std::min<size_t>(std::max(1, max_threads), size));
+
+  if (threads == 1) {
+    func((size_t) 0, size, 0);
+    return;
+  }
+
+  // the calling thread takes the first slice itself
+  thread_pool().reserve(threads - 1);
+  TaskGroup group {};
+  for (int t = 1; t < threads; t++) {
+    size_t begin = size * t / threads;
+    size_t end   = size * (t + 1) / threads;
+    group.run([&func, begin, end, t]() { func(begin, end, t); });
+  }
+  func((size_t) 0, size / threads, 0);
+  group.wait();
+}
+
+/**
+ * calls func(i) for each i in [0, count) as a separate task, so uneven tasks are balanced by
+ * stealing. At most limit tasks are in flight at once.
+ */
+template<typename F>
+inline void parallel_tasks(size_t count, F&& func, size_t limit = SIZE_MAX) {
+  TaskGroup group {limit};
+  for (size_t i = 0; i < count; i++)
+    group.run([&func, i]() { func(i); });
+  group.wait();
+}
+
+#endif
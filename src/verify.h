@@ -0,0 +1,155 @@
+#ifndef VERIFY_H
+#define VERIFY_H
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "blockfile.h"
+#include "position.h"
+#include "threads.h"
+
+#define VERIFY_CHUNK_SIZE  (1 << 16)
+#define VERIFY_MAX_REPORTS (16)
+
+/**
+ * checks that the position only contains valid pieces and meta information.
+ */
+inline bool is_plausible(const Position& p) {
+  // the piece list only holds MAX_PIECES_PER_BOARD pieces
+  const int pieces = p.get_piece_count();
+  if (pieces > MAX_PIECES_PER_BOARD)
+    return false;
+  for (int i = 0; i < pieces; i++) {
+    Piece piece = p.m_pieces.get_piece(i);
+    if ((piece & 0x7) > 5)
+      return false;
+  }
+  // squares are signed, so negative en passant squares wrap around above N_SQUARES
+  return (uint8_t) p.m_meta.m_en_passant_square <= N_SQUARES && p.m_result.wdl >= -1 && p.m_result.wdl <= 1;
+}
+
+/**
+ * collects the indices of failing blocks or chunks across threads and reports the first few.
+ */
+struct VerifyReport {
+  std::mutex mutex {};
+  std::vector<size_t> failed {};
+
+  void fail(size_t index) {
+    std::lock_guard<std::mutex> lock {mutex};
+    failed.push_back(index);
+  }
+
+  bool print(const std::string& file, const std::string& unit, size_t total) {
+    std::sort(failed.begin(), failed.end());
+    if (failed.empty()) {
+      std::cout << file << ": ok (" << total << " " << unit << "s)" << std::endl;
+      return true;
+    }
+    std::cout << file << ": " << failed.size() << " of " << total << " " << unit << "(s) failed:";
+    for (size_t i = 0; i < std::min<size_t>(failed.size(), VERIFY_MAX_REPORTS); i++)
+      std::cout << " " << failed[i];
+    std::cout << (failed.size() > VERIFY_MAX_REPORTS ? " ..." : "") << std::endl;
+    return false;
+  }
+};
+
+/**
+ * verifies all block checksums of a block compressed file in parallel. If decode is set, every
+ * block is also decompressed and its positions checked for plausibility.
+ */
+inline bool verify_block_file(const std::string& file, bool decode) {
+  BlockReader reader {file};
+  if (!reader.is_open())
+    return false;
+  if (!reader.has_checksums() && !decode)
+    std::cout << file << ": version " << reader.file_header.version << " files have no checksums, use --decode"
+              << std::endl;
+
+  VerifyReport report {};
+  std::atomic<size_t> next {0};
+  parallel_for(thread_count(), [&](size_t, size_t, int) {
+    std::vector<uint8_t> data {};
+    std::vector<Position> positions {};
+    for (size_t b = next++; b < reader.block_count(); b = next++) {
+      bool valid = reader.read_raw_block(b, data) && reader.check_block(b, data);
+      if (valid && decode) {
+        positions.resize(reader.index[b].count);
+        valid = decompress_block(data, reader.file_header, positions.data(), positions.size(), reader.tables.get())
+                && std::all_of(positions.begin(), positions.end(), is_plausible);
+      }
+      if (!valid)
+        report.fail(b);
+    }
+  });
+  return report.print(file, "block", reader.block_count());
+}
+
+/**
+ * verifies a raw fin file. Raw files carry no checksums, so only the size is compared against the
+ * header and, if decode is set, the positions are checked for plausibility.
+ */
+inline bool verify_raw_file(const std::string& file, bool decode) {
+  FILE* f = fopen(file.c_str(), "rb");
+  if (f == nullptr) {
+    std::cout << "could not open: " << file << std::endl;
+    return false;
+  }
+
+  Header header {};
+  struct stat st {};
+  bool valid = fread(&header, sizeof(Header), 1, f) == 1 && fstat(fileno(f), &st) == 0;
+  uint64_t expected = sizeof(Header) + header.position_count * sizeof(Position);
+  if (!valid || (uint64_t) st.st_size != expected) {
+    std::cout << file << ": size " << st.st_size << " does not match the " << header.position_count
+              << " position(s) of the header" << std::endl;
+    fclose(f);
+    return false;
+  }
+  if (!decode) {
+    fclose(f);
+    std::cout << file << ": ok (size matches " << header.position_count << " positions)" << std::endl;
+    return true;
+  }
+
+  const size_t chunks = (header.position_count + VERIFY_CHUNK_SIZE - 1) / VERIFY_CHUNK_SIZE;
+  VerifyReport report {};
+  std::atomic<size_t> next {0};
+  parallel_for(thread_count(), [&](size_t, size_t, int) {
+    std::vector<Position> positions(VERIFY_CHUNK_SIZE);
+    for (size_t c = next++; c < chunks; c = next++) {
+      uint64_t first = (uint64_t) c * VERIFY_CHUNK_SIZE;
+      size_t count   = std::min<uint64_t>(VERIFY_CHUNK_SIZE, header.position_count - first);
+      ssize_t bytes  = count * sizeof(Position);
+      if (pread(fileno(f), positions.data(), bytes, sizeof(Header) + first * sizeof(Position)) != bytes
+          || !std::all_of(positions.begin(), positions.begin() + count, is_plausible))
+        report.fail(c);
+    }
+  });
+  fclose(f);
+  return report.print(file, "chunk", chunks);
+}
+
+/**
+ * verifies the given file, detecting block compressed files by their magic.
+ */
+inline bool verify_file(const std::string& file, bool decode) {
+  FILE* f = fopen(file.c_str(), "rb");
+  if (f == nullptr) {
+    std::cout << "could not open: " << file << std::endl;
+    return false;
+  }
+  bool block = is_block_file(f);
+  fclose(f);
+  return block ? verify_block_file(file, decode) : verify_raw_file(file, decode);
+}
+
+#endif
@@ -1,15 +1,31 @@
 #ifndef WRITER_H
 #define WRITER_H
 
-#include <cmath>
+#include <algorithm>
+#include <iostream>
+#include <memory>
 #include <string>
+#include <vector>
 
+#include "blockfile.h"
 #include "dataset.h"
 #include "position.h"
+#include "progress.h"
+#include "threads.h"
 
-inline void write(const std::string& file, const DataSet& data_set, uint64_t count = -1) {
+inline void write(const std::string& file,
+                  const DataSet& data_set,
+                  uint64_t count              = -1,
+                  const BlockOptions& options = BlockOptions {}) {
   constexpr uint64_t CHUNK_SIZE = (1 << 20);
 
+  // block compressed files are written through the block writer
+  if (is_block_file_name(file)) {
+    BlockWriter writer {file, options, data_set.header};
+    writer.write(data_set.positions.data(), std::min(count, data_set.positions.size()));
+    return;
+  }
+
   // open the file
   FILE* f = fopen(file.c_str(), "wb");
   if (f == nullptr) {
@@ -26,21 +42,157 @@ inline void write(const std::string& file, const DataSet& data_set, uint64_t cou
   // write the header
   fwrite(&header, sizeof(Header), 1, f);
 
-  // compute how much data to read
-  int chunks = std::ceil(data_to_write / (float) CHUNK_SIZE);
-
   // actually write
-  for (int c = 0; c < chunks; c++) {
-    int start = c * CHUNK_SIZE;
-    int end   = c * CHUNK_SIZE + CHUNK_SIZE;
-    if (end > data_set.positions.size())
-      end = data_set.positions.size();
-    fwrite(&data_set.positions[start], sizeof(Position), end - start, f);
-    printf("\r[Writing positions] Current count=%d", end);
-    fflush(stdout);
+  StageCounters& stage = progress_stage("write");
+  for (uint64_t start = 0; start < data_to_write; start += CHUNK_SIZE) {
+    uint64_t end = std::min<uint64_t>(start + CHUNK_SIZE, data_to_write);
+    const size_t written = fwrite(&data_set.positions[start], sizeof(Position), end - start, f);
+    stage.add(written, written * sizeof(Position));
   }
-  std::cout << std::endl;
 
   fclose(f);
 }
+
+/**
+ * buffered writer for binary fin files. The header is written when opening the file and
+ * patched with the final position count when the writer is closed. File names ending in
+ * .finz are written as block compressed files. If append is set, the positions are appended
+ * to an existing binary file written by a previous writer, which block compressed files do
+ * not support. Once a write fails, the writer is failed and the output incomplete.
+ */
+struct FinWriter {
+  FILE* f = nullptr;
+  std::unique_ptr<BlockWriter> block {};
+  Header header {};
+  std::vector<Position> buffer {};
+  size_t buffer_size;
+  bool failed          = false;
+  StageCounters& stage = progress_stage("write");
+
+  explicit FinWriter(const std::string& file,
+                     size_t p_buffer_size        = (1 << 16),
+                     const BlockOptions& options = BlockOptions {},
+                     bool append                 = false) :
+      buffer_size(p_buffer_size) {
+    if (is_block_file_name(file)) {
+      if (append) {
+        std::cout << "cannot append to block compressed file: " << file << std::endl;
+        return;
+      }
+      block = std::make_unique<BlockWriter>(file, options);
+      if (!block->is_open())
+        block.reset();
+      return;
+    }
+
+    f = fopen(file.c_str(), append ? "r+b" : "wb");
+    if (f == nullptr) {
+      std::cout << "could not open: " << file << std::endl;
+      return;
+    }
+    if (append) {
+      // continue after the positions counted in the header
+      if (fread(&header, sizeof(Header), 1, f) != 1
+          || fseek(f, sizeof(Header) + header.position_count * sizeof(Position), SEEK_SET) != 0) {
+        std::cout << "could not append to: " << file << std::endl;
+        fclose(f);
+        f = nullptr;
+        return;
+      }
+    } else {
+      failed = fwrite(&header, sizeof(Header), 1, f) != 1;
+    }
+    buffer.reserve(buffer_size);
+  }
+
+  FinWriter(const FinWriter&)            = delete;
+  FinWriter& operator=(const FinWriter&) = delete;
+
+  ~FinWriter() {
+    close();
+  }
+
+  bool is_open() const {
+    return f != nullptr || block != nullptr;
+  }
+
+  void write(const Position& position) {
+    if (block != nullptr) {
+      block->write(position);
+      return;
+    }
+    buffer.push_back(position);
+    if (buffer.size() >= buffer_size)
+      flush();
+  }
+
+  void flush() {
+    if (f != nullptr && !buffer.empty()) {
+      const size_t written = fwrite(buffer.data(), sizeof(Position), buffer.size(), f);
+      failed |= written != buffer.size();
+      header.position_count += written;
+      stage.add(written, written * sizeof(Position));
+    }
+    buffer.clear();
+  }
+
+  /**
+   * writes the remaining positions, patches the header and closes the file.
+   * @return false if any write failed
+   */
+  bool close() {
+    if (block != nullptr) {
+      failed |= !block->close();
+      header.position_count = block->file_header.header.position_count;
+      block.reset();
+      return !failed;
+    }
+    if (f == nullptr)
+      return !failed;
+    flush();
+    failed |= fseek(f, 0, SEEK_SET) != 0 || fwrite(&header, sizeof(Header), 1, f) != 1;
+    failed |= fclose(f) != 0;
+    f = nullptr;
+    return !failed;
+  }
+};
+
+/**
+ * writes each position to the writer given by its destination index. Each writer is only touched
+ * by one thread and receives its positions in their original order.
+ * @return false if any of the writers failed
+ */
+template<typename W>
+inline bool write_routed(const std::vector<Position>& positions,
+                         const std::vector<uint32_t>& destinations,
+                         std::vector<W>& writers) {
+  parallel_for(writers.size(), [&](size_t begin, size_t end, int) {
+    for (size_t i = 0; i < positions.size(); i++)
+      if (destinations[i] >= begin && destinations[i] < end)
+        writers[destinations[i]]->write(positions[i]);
+  });
+  return std::none_of(writers.begin(), writers.end(), [](const W& writer) { return writer->failed; });
+}
+
+/**
+ * reorders the positions so the positions of each destination are contiguous and keep their order.
+ * The positions of destination d are stored in [starts[d], starts[d + 1]) of grouped.
+ */
+inline void group_by_destination(const std::vector<Position>& positions,
+                                 const std::vector<uint32_t>& destinations,
+                                 size_t destination_count,
+                                 std::vector<Position>& grouped,
+                                 std::vector<size_t>& starts) {
+  starts.assign(destination_count + 1, 0);
+  for (uint32_t d : destinations)
+    starts[d + 1]++;
+  for (size_t d = 0; d < destination_count; d++)
+    starts[d + 1] += starts[d];
+
+  std::vector<size_t> next(starts.begin(), starts.end() - 1);
+  grouped.resize(positions.size());
+  for (size_t i = 0; i < positions.size(); i++)
+    grouped[next[destinations[i]]++] = positions[i];
+}
+
 #endif